@@ -0,0 +1,275 @@
+/**
+ * @file benchmark.hpp
+ * @brief Small micro-benchmark harness shared by the Core/ demos
+ *
+ * Usage:
+ *     bench::Benchmark b("scan_image");
+ *     Mat work = I.clone();                        // allocate once, outside the timed region
+ *     b.run("C operator[]", bytes,
+ *           [&]{ I.copyTo(work); },                // untimed reset before every sample
+ *           [&]{ ScanImageAndReduceC(work, table); });
+ *     b.print(cout);
+ *     b.writeJson("scan_image.json");              // diff this file between commits in CI
+ *
+ * Every sample is one call of the body, timed on its own. The first
+ * Options::warmup calls are not recorded (page faults, cold caches, thread
+ * pool start-up). Options::threads fixes the OpenCV thread pool size and
+ * Options::pinCpu pins the timing thread to one CPU, so two runs are
+ * comparable. Pinning is off by default: a thread that a body starts
+ * inherits the pin and would share that one CPU. The affinity is restored
+ * when the Benchmark is destroyed.
+ */
+
+#ifndef CORE_BENCHMARK_HPP
+#define CORE_BENCHMARK_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace bench
+{
+
+struct Options
+{
+		int warmup;      // calls before recording starts
+		int iterations;  // recorded samples per method
+		int threads;     // OpenCV thread pool size, <= 0 keeps the default
+		int pinCpu;      // CPU the timing thread runs on, < 0 (the default) disables pinning
+
+		Options() : warmup(5), iterations(100), threads(0), pinCpu(-1)
+		{}
+};
+
+struct Result
+{
+		std::string name;
+		double bytes;                 // bytes processed by one call, 0 if not meaningful
+		std::vector<double> samplesMs;
+		double minMs, medianMs, p95Ms, meanMs;
+		double mbPerSec;              // bytes / median time
+};
+
+// value at the given fraction (0..1) of the sorted samples, nearest rank
+inline double percentile(const std::vector<double>& sorted, double fraction)
+{
+		if (sorted.empty())
+				return 0;
+		size_t rank = (size_t)std::ceil(fraction * sorted.size());
+		return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+inline bool pinCurrentThread(int cpu)
+{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+		(void)cpu;
+		return false;
+#endif
+}
+
+// the CPUs the calling thread may run on, to be given back with restore()
+class Affinity
+{
+public:
+		Affinity() : m_saved(false) {}
+
+		bool save()
+		{
+#ifdef __linux__
+				m_saved = sched_getaffinity(0, sizeof(m_set), &m_set) == 0;
+#endif
+				return m_saved;
+		}
+
+		void restore()
+		{
+#ifdef __linux__
+				if (m_saved)
+						sched_setaffinity(0, sizeof(m_set), &m_set);
+#endif
+				m_saved = false;
+		}
+
+private:
+		bool m_saved;
+#ifdef __linux__
+		cpu_set_t m_set;
+#endif
+};
+
+class Benchmark
+{
+public:
+		explicit Benchmark(const std::string& suite, const Options& options = Options())
+				: m_suite(suite), m_options(options), m_pinned(false)
+		{
+				if (m_options.threads > 0)
+						cv::setNumThreads(m_options.threads);
+				if (m_options.pinCpu >= 0)
+				{
+						// threads inherit the affinity of the thread that creates them, so start
+						// the OpenCV worker threads first; only the timing thread gets pinned
+						cv::parallel_for_(cv::Range(0, cv::getNumThreads()), NoOp());
+						m_pinned = m_affinity.save() && pinCurrentThread(m_options.pinCpu);
+				}
+		}
+
+		~Benchmark()
+		{
+				m_affinity.restore();
+		}
+
+		// time body() alone; reset() runs before every call but outside the timed region.
+		// Returns a copy: results() grows with every run.
+		template<typename Reset, typename Body>
+		Result run(const std::string& name, double bytes, Reset reset, Body body)
+		{
+				for (int i = 0; i < m_options.warmup; ++i)
+				{
+						reset();
+						body();
+				}
+
+				Result r;
+				r.name = name;
+				r.bytes = bytes;
+				r.samplesMs.reserve(m_options.iterations);
+				for (int i = 0; i < m_options.iterations; ++i)
+				{
+						reset();
+						int64 t = cv::getTickCount();
+						body();
+						t = cv::getTickCount() - t;
+						r.samplesMs.push_back(1000.0 * t / cv::getTickFrequency());
+				}
+
+				std::vector<double> sorted(r.samplesMs);
+				std::sort(sorted.begin(), sorted.end());
+				r.minMs = sorted.empty() ? 0 : sorted.front();
+				r.medianMs = percentile(sorted, 0.5);
+				r.p95Ms = percentile(sorted, 0.95);
+				double sum = 0;
+				for (size_t i = 0; i < sorted.size(); ++i)
+						sum += sorted[i];
+				r.meanMs = sorted.empty() ? 0 : sum / sorted.size();
+				r.mbPerSec = r.medianMs > 0 ? bytes / (r.medianMs * 1e-3) / (1 << 20) : 0;
+
+				m_results.push_back(r);
+				return m_results.back();
+		}
+
+		template<typename Body>
+		Result run(const std::string& name, double bytes, Body body)
+		{
+				return run(name, bytes, []{}, body);
+		}
+
+		const std::vector<Result>& results() const { return m_results; }
+
+		void print(std::ostream& out) const
+		{
+				size_t width = 6;
+				for (size_t i = 0; i < m_results.size(); ++i)
+						width = std::max(width, m_results[i].name.size());
+
+				out << m_suite << ": " << m_options.iterations << " samples after "
+						<< m_options.warmup << " warm-up runs, " << cv::getNumThreads() << " threads"
+						<< (m_pinned ? ", timing thread pinned" : "") << std::endl;
+				out << std::left << std::setw((int)width) << "method" << std::right
+						<< std::setw(12) << "min ms" << std::setw(12) << "median ms"
+						<< std::setw(12) << "p95 ms" << std::setw(12) << "mean ms"
+						<< std::setw(12) << "MB/s" << std::endl;
+				std::ios::fmtflags flags = out.flags();
+				out << std::fixed << std::setprecision(3);
+				for (size_t i = 0; i < m_results.size(); ++i)
+				{
+						const Result& r = m_results[i];
+						out << std::left << std::setw((int)width) << r.name << std::right
+								<< std::setw(12) << r.minMs << std::setw(12) << r.medianMs
+								<< std::setw(12) << r.p95Ms << std::setw(12) << r.meanMs
+								<< std::setw(12) << std::setprecision(1) << r.mbPerSec
+								<< std::setprecision(3) << std::endl;
+				}
+				out.flags(flags);
+		}
+
+		// one object per suite, one entry per method, in the order they ran
+		void writeJson(std::ostream& out) const
+		{
+				out << "{\n  \"suite\": \"" << escape(m_suite) << "\",\n"
+						<< "  \"threads\": " << cv::getNumThreads() << ",\n"
+						<< "  \"warmup\": " << m_options.warmup << ",\n"
+						<< "  \"iterations\": " << m_options.iterations << ",\n"
+						<< "  \"results\": [";
+				out << std::setprecision(6);
+				for (size_t i = 0; i < m_results.size(); ++i)
+				{
+						const Result& r = m_results[i];
+						out << (i ? "," : "") << "\n    {\"name\": \"" << escape(r.name) << "\""
+								<< ", \"bytes\": " << r.bytes
+								<< ", \"min_ms\": " << r.minMs
+								<< ", \"median_ms\": " << r.medianMs
+								<< ", \"p95_ms\": " << r.p95Ms
+								<< ", \"mean_ms\": " << r.meanMs
+								<< ", \"mb_per_s\": " << r.mbPerSec
+								<< ", \"samples_ms\": [";
+						for (size_t k = 0; k < r.samplesMs.size(); ++k)
+								out << (k ? ", " : "") << r.samplesMs[k];
+						out << "]}";
+				}
+				out << "\n  ]\n}\n";
+		}
+
+		bool writeJson(const std::string& path) const
+		{
+				std::ofstream f(path.c_str());
+				if (!f)
+						return false;
+				writeJson(f);
+				return (bool)f;
+		}
+
+private:
+		class NoOp : public cv::ParallelLoopBody
+		{
+		public:
+				virtual void operator ()(const cv::Range&) const CV_OVERRIDE {}
+		};
+
+		static std::string escape(const std::string& s)
+		{
+				std::string e;
+				for (size_t i = 0; i < s.size(); ++i)
+				{
+						if (s[i] == '"' || s[i] == '\\')
+								e += '\\';
+						e += s[i];
+				}
+				return e;
+		}
+
+		std::string m_suite;
+		Options m_options;
+		bool m_pinned;
+		Affinity m_affinity;   // of the timing thread before it was pinned
+		std::vector<Result> m_results;
+};
+
+} // namespace bench
+
+#endif // CORE_BENCHMARK_HPP
@@ -0,0 +1,276 @@
+/**
+ * @file blend.hpp
+ * @brief N-way 8-bit blender: every layer read once, the output written once
+ *
+ *     std::vector<blend::Layer> layers;
+ *     layers.push_back(blend::Layer(background, 1.0));
+ *     layers.push_back(blend::Layer(logo, 0.8, logoMask));              // over, straight alpha
+ *     layers.push_back(blend::Layer(overlay, 1.0, Mat(), true));        // over, premultiplied BGRA
+ *     blend::blend(layers, dst);
+ *
+ * Layers are applied bottom to top on an accumulator that starts black:
+ *
+ * - plain layer:   acc += w * src, so plain layers alone give the same
+ *                  result as a chain of addWeighted (gamma = 0)
+ * - with a mask:   acc = acc * (1 - w*m) + w*m * src, m = mask / 255
+ * - premultiplied: acc = acc * (1 - w*a) + w * src, a = channel 3 / 255,
+ *                  the usual "over" for premultiplied color (and for a)
+ *
+ * The accumulator is 16-bit fixed point with 8 fractional bits and saturates.
+ * Weights are rounded to 1/256, which moves each layer's contribution by up to
+ * half a level (a chain of addWeighted rounds after every step instead). The
+ * accumulator covers a block of pixels that stays in L1, and the rows are
+ * split over the threads. On x86 the AVX2 loops are built whatever the -m
+ * flags and used when the CPU has AVX2, as in parallel.cpp.
+ */
+
+#ifndef CORE_BLEND_HPP
+#define CORE_BLEND_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEND_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define BLEND_X86_DISPATCH 0
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace blend
+{
+
+struct Layer
+{
+		cv::Mat image;       // CV_8UC(n), the same size and type for every layer
+		double weight;       // 0 .. 1, the opacity for masked and premultiplied layers
+		cv::Mat mask;        // empty, or CV_8UC1 straight alpha of the same size
+		bool premultiplied;  // 4 channels, color premultiplied by channel 3
+
+		Layer(const cv::Mat& image_, double weight_, const cv::Mat& mask_ = cv::Mat(), bool premultiplied_ = false)
+				: image(image_), weight(weight_), mask(mask_), premultiplied(premultiplied_)
+		{}
+};
+
+namespace detail
+{
+// v / 255 rounded to nearest, exact for 0 <= v <= 256 * 255
+inline int div255(int v)
+{
+		return (v + 128 + ((v + 128) >> 8)) >> 8;
+}
+
+#if BLEND_X86_DISPATCH
+inline bool hasAvx2()
+{
+		static const bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+		return avx2;
+}
+
+// The AVX2 loops of addConstant, addVarying and store, 16 values per step;
+// each returns the number of values done
+__attribute__((target("avx2")))
+inline int addConstantAvx2(const uchar* src, ushort* acc, int n, ushort g)
+{
+		int j = 0;
+		const __m256i vg = _mm256_set1_epi16((short)g);
+		for ( ; j <= n - 16; j += 16)
+		{
+				const __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + j)));
+				const __m256i a = _mm256_loadu_si256((const __m256i*)(acc + j));
+				_mm256_storeu_si256((__m256i*)(acc + j), _mm256_adds_epu16(a, _mm256_mullo_epi16(x, vg)));
+		}
+		return j;
+}
+
+__attribute__((target("avx2")))
+inline int addVaryingAvx2(const uchar* src, ushort* acc, int n, const ushort* keep, const ushort* g)
+{
+		int j = 0;
+		for ( ; j <= n - 16; j += 16)
+		{
+				const __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + j)));
+				__m256i a = _mm256_loadu_si256((const __m256i*)(acc + j));
+				a = _mm256_sub_epi16(a, _mm256_mulhi_epu16(a, _mm256_loadu_si256((const __m256i*)(keep + j))));
+				a = _mm256_adds_epu16(a, _mm256_mullo_epi16(x, _mm256_loadu_si256((const __m256i*)(g + j))));
+				_mm256_storeu_si256((__m256i*)(acc + j), a);
+		}
+		return j;
+}
+
+__attribute__((target("avx2")))
+inline int storeAvx2(const ushort* acc, uchar* dst, int n)
+{
+		int j = 0;
+		for ( ; j <= n - 16; j += 16)
+		{
+				const __m256i a = _mm256_loadu_si256((const __m256i*)(acc + j));
+				// (a + 128) >> 8 without overflowing 16 bits
+				const __m256i r = _mm256_add_epi16(_mm256_srli_epi16(a, 8),
+																					 _mm256_and_si256(_mm256_srli_epi16(a, 7), _mm256_set1_epi16(1)));
+				_mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+		}
+		return j;
+}
+#endif
+
+// acc = sat(acc + g * src), the same g everywhere
+inline void addConstant(const uchar* src, ushort* acc, int n, ushort g)
+{
+		int j = 0;
+#if BLEND_X86_DISPATCH
+		if (hasAvx2())
+				j = addConstantAvx2(src, acc, n, g);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		const uint16x8_t vg = vdupq_n_u16(g);
+		for ( ; j <= n - 8; j += 8)
+				vst1q_u16(acc + j, vqaddq_u16(vld1q_u16(acc + j), vmulq_u16(vmovl_u8(vld1_u8(src + j)), vg)));
+#endif
+		for ( ; j < n; ++j)
+				acc[j] = (ushort)std::min(acc[j] + src[j] * g, 65535);
+}
+
+// acc = sat(acc - acc * keep / 65536 + g * src), keep and g per value
+inline void addVarying(const uchar* src, ushort* acc, int n, const ushort* keep, const ushort* g)
+{
+		int j = 0;
+#if BLEND_X86_DISPATCH
+		if (hasAvx2())
+				j = addVaryingAvx2(src, acc, n, keep, g);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		for ( ; j <= n - 8; j += 8)
+		{
+				uint16x8_t a = vld1q_u16(acc + j);
+				const uint16x8_t k = vld1q_u16(keep + j);
+				const uint16x8_t hi = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(a), vget_low_u16(k)), 16),
+																					 vshrn_n_u32(vmull_high_u16(a, k), 16));
+				a = vqaddq_u16(vsubq_u16(a, hi), vmulq_u16(vmovl_u8(vld1_u8(src + j)), vld1q_u16(g + j)));
+				vst1q_u16(acc + j, a);
+		}
+#endif
+		for ( ; j < n; ++j)
+				acc[j] = (ushort)std::min(acc[j] - (int)(((unsigned)acc[j] * keep[j]) >> 16) + src[j] * g[j], 65535);
+}
+
+// dst = round(acc / 256), saturated
+inline void store(const ushort* acc, uchar* dst, int n)
+{
+		int j = 0;
+#if BLEND_X86_DISPATCH
+		if (hasAvx2())
+				j = storeAvx2(acc, dst, n);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+		for ( ; j <= n - 8; j += 8)
+				vst1_u8(dst + j, vqmovn_u16(vrshrq_n_u16(vld1q_u16(acc + j), 8)));
+#endif
+		for ( ; j < n; ++j)
+				dst[j] = (uchar)std::min((acc[j] >> 8) + ((acc[j] >> 7) & 1), 255);
+}
+
+// keep and gain of addVarying for a masked and/or premultiplied layer: per pixel
+// the opacity o (1/256 steps) and what the layer covers, copied to each channel
+template<int CN>
+void coverage(const uchar* src, const uchar* mask, int weight, bool premultiplied, int pixels, int cn,
+							ushort* keep, ushort* gain)
+{
+		if (CN > 0)
+				cn = CN;
+		for (int p = 0; p < pixels; ++p)
+		{
+				const int o = mask ? div255(weight * mask[p]) : weight;
+				const int cover = premultiplied ? div255(o * src[p * cn + 3]) : o;
+				const ushort k = (ushort)std::min(cover << 8, 65535), g = (ushort)(premultiplied ? o : cover);
+				for (int c = 0; c < cn; ++c)
+				{
+						keep[p * cn + c] = k;
+						gain[p * cn + c] = g;
+				}
+		}
+}
+
+// Blends one run of pixels, block by block, starting at row y of every layer.
+// The buffers are members, so a Runner on the stack of a task allocates nothing.
+class Runner
+{
+public:
+		enum { BLOCK = 4096 };   // values (pixels * channels) per accumulator block
+
+		Runner(const std::vector<Layer>& layers, const std::vector<int>& weights, int cn)
+				: m_layers(layers), m_weights(weights), m_cn(cn)
+		{}
+
+		void run(int y, uchar* dst, int pixels)
+		{
+				const int cn = m_cn, blockPixels = std::max(BLOCK / cn, 1);
+				for (int p0 = 0; p0 < pixels; p0 += blockPixels)
+				{
+						const int np = std::min(blockPixels, pixels - p0), n = np * cn;
+						std::fill(m_acc, m_acc + n, (ushort)0);
+						for (size_t i = 0; i < m_layers.size(); ++i)
+						{
+								const Layer& layer = m_layers[i];
+								const uchar* src = layer.image.ptr<uchar>(y) + (size_t)p0 * cn;
+								if (layer.mask.empty() && !layer.premultiplied)
+								{
+										addConstant(src, m_acc, n, (ushort)m_weights[i]);
+										continue;
+								}
+								const uchar* mask = layer.mask.empty() ? 0 : layer.mask.ptr<uchar>(y) + p0;
+								// a fixed channel count lets the compiler unroll and vectorize the copies
+								void (*cover)(const uchar*, const uchar*, int, bool, int, int, ushort*, ushort*) =
+										cn == 1 ? coverage<1> : cn == 3 ? coverage<3> : cn == 4 ? coverage<4> : coverage<0>;
+								cover(src, mask, m_weights[i], layer.premultiplied, np, cn, m_keep, m_gain);
+								addVarying(src, m_acc, n, m_keep, m_gain);
+						}
+						store(m_acc, dst + (size_t)p0 * cn, n);
+				}
+		}
+
+private:
+		const std::vector<Layer>& m_layers;
+		const std::vector<int>& m_weights;
+		int m_cn;
+		ushort m_acc[BLOCK], m_keep[BLOCK], m_gain[BLOCK];
+};
+} // namespace detail
+
+// dst = the layers blended bottom (layers[0]) to top, see the file comment
+inline void blend(const std::vector<Layer>& layers, cv::Mat& dst)
+{
+		CV_Assert(!layers.empty());
+		const cv::Mat& first = layers[0].image;
+		CV_Assert(first.depth() == CV_8U);
+		const int cn = first.channels();
+		bool continuous = true;
+		std::vector<int> weights(layers.size());
+		for (size_t i = 0; i < layers.size(); ++i)
+		{
+				const Layer& layer = layers[i];
+				CV_Assert(layer.image.size() == first.size() && layer.image.type() == first.type());
+				CV_Assert(layer.weight >= 0 && layer.weight <= 1);
+				CV_Assert(layer.mask.empty() || (layer.mask.type() == CV_8UC1 && layer.mask.size() == first.size()));
+				CV_Assert(!layer.premultiplied || cn == 4);
+				weights[i] = cvRound(layer.weight * 256);
+				continuous = continuous && layer.image.isContinuous() && (layer.mask.empty() || layer.mask.isContinuous());
+		}
+
+		// dst may be one of the layers: each block is read completely before it is written
+		dst.create(first.size(), first.type());
+		continuous = continuous && dst.isContinuous();
+		cv::parallel_for_(cv::Range(0, first.rows), [&](const cv::Range& range){
+				detail::Runner runner(layers, weights, cn);
+				const int rows = continuous ? 1 : range.end - range.start;
+				const int pixels = continuous ? first.cols * (range.end - range.start) : first.cols;
+				for (int y = range.start; y < range.start + rows; ++y)
+						runner.run(y, dst.ptr<uchar>(y), pixels);
+		}, (double)first.total() * first.elemSize() * layers.size() / (1 << 18));
+}
+
+} // namespace blend
+
+#endif // CORE_BLEND_HPP
@@ -0,0 +1,372 @@
+/**
+ * @file convolution.hpp
+ * @brief filter2D-compatible filtering that picks spatial, separable or FFT execution
+ *
+ *     conv::filter(src, dst, kernel);                     // METHOD_AUTO
+ *     conv::filter(src, dst, kernel, conv::METHOD_FFT);   // force one
+ *
+ * Same result as filter2D(src, dst, src.depth(), kernel) with the anchor in the
+ * kernel centre (a correlation, like filter2D), every border mode included.
+ *
+ * - spatial:   spatialFilter, kh * kw multiply-adds per pixel at any size:
+ *              filter2D while it stays spatial, a direct loop for the larger
+ *              kernels filter2D would hand to its own DFT
+ * - separable: sepFilter2D, kh + kw, used when the kernel is rank one
+ * - FFT:       overlap-add. The border-extended image is cut into tiles, each
+ *              tile is transformed with the real-input DFT (CCS, see
+ *              discrete_Fourier_transform.cpp), multiplied by the kernel
+ *              spectrum and transformed back. Each tile's result, which is
+ *              kernel - 1 larger than the tile, is added into a float
+ *              accumulator. The cost per pixel barely depends on the kernel size.
+ *
+ * METHOD_AUTO takes the cheapest according to estimate(); the constants are
+ * rough, run mask_operation --sweep to see where the crossover really is.
+ */
+
+#ifndef CORE_CONVOLUTION_HPP
+#define CORE_CONVOLUTION_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace conv
+{
+
+enum Method { METHOD_AUTO = 0, METHOD_SPATIAL = 1, METHOD_SEPARABLE = 2, METHOD_FFT = 3 };
+
+inline const char* methodName(int method)
+{
+		static const char* names[] = { "auto", "spatial", "separable", "fft" };
+		return method >= METHOD_AUTO && method <= METHOD_FFT ? names[method] : "?";
+}
+
+// DFT size of one overlap-add tile. The kernel takes kernel - 1 of it, so it is at
+// least 4x the kernel (and never less than twice, which the two passes in
+// fftFilter rely on), or a single tile when the whole image fits.
+inline cv::Size fftTileSize(const cv::Size& image, const cv::Size& kernel)
+{
+		const int h = std::min(std::max(256, 4 * (kernel.height - 1)), image.height + 2 * (kernel.height - 1));
+		const int w = std::min(std::max(256, 4 * (kernel.width - 1)), image.width + 2 * (kernel.width - 1));
+		return cv::Size(cv::getOptimalDFTSize(w), cv::getOptimalDFTSize(h));
+}
+
+// multiply-adds per output pixel and channel
+struct Cost
+{
+		double spatial;
+		double separable;
+		double fft;
+};
+
+inline Cost estimate(const cv::Size& image, const cv::Size& kernel)
+{
+		Cost c;
+		c.spatial = (double)kernel.area();
+		c.separable = kernel.width + kernel.height + 2.0;  // two passes, the second reloads the row
+
+		// per tile: a forward and an inverse real FFT, the spectrum product, and
+		// filling/adding back the tile; shared by the tile's pixels. A real FFT is
+		// ~2.5 n log2 n flops, counted as two multiply-adds each: on a 512x512 BGR
+		// image cv::dft costs about twice a tap of spatialFilter per flop, which
+		// puts the crossover for square kernels between 13x13 and 15x15
+		const cv::Size f = fftTileSize(image, kernel);
+		const double n = (double)f.area();
+		const double pixels = (double)(f.width - kernel.width + 1) * (f.height - kernel.height + 1);
+		c.fft = (2 * 2 * 2.5 * n * std::log2(n) + 3 * n + 2 * n) / pixels;
+		return c;
+}
+
+inline int choose(const cv::Size& image, const cv::Size& kernel, bool separable)
+{
+		const Cost c = estimate(image, kernel);
+		int best = METHOD_SPATIAL;
+		double cost = c.spatial;
+		if (separable && c.separable < cost)
+		{
+				best = METHOD_SEPARABLE;
+				cost = c.separable;
+		}
+		if (c.fft < cost)
+				best = METHOD_FFT;
+		return best;
+}
+
+// kernel == ky * kx (a column times a row)? Exact up to rounding, no SVD needed:
+// the row and the column through the largest coefficient must reproduce it.
+inline bool separableFactors(const cv::Mat& kernel, cv::Mat& kx, cv::Mat& ky)
+{
+		cv::Mat k;
+		kernel.convertTo(k, CV_64F);
+		int py = 0, px = 0;
+		double peak = 0;
+		for (int i = 0; i < k.rows; ++i)
+				for (int j = 0; j < k.cols; ++j)
+						if (std::abs(k.at<double>(i, j)) > peak)
+						{
+								peak = std::abs(k.at<double>(i, j));
+								py = i;
+								px = j;
+						}
+		if (peak == 0)
+				return false;
+
+		cv::Mat row = k.row(py).clone(), col;
+		k.col(px).convertTo(col, CV_64F, 1.0 / k.at<double>(py, px));
+		for (int i = 0; i < k.rows; ++i)
+				for (int j = 0; j < k.cols; ++j)
+						if (std::abs(col.at<double>(i) * row.at<double>(j) - k.at<double>(i, j)) > 1e-6 * peak)
+								return false;
+		row.convertTo(kx, CV_32F);
+		col.convertTo(ky, CV_32F);
+		return true;
+}
+
+namespace detail
+{
+// channel c of the extended-image block (y0, x0, rows x cols) into the top-left of buf
+template<typename T>
+void gatherTile(const cv::Mat& src, const int* rowOf, const int* colOf, int y0, int x0, int rows, int cols,
+								int c, cv::Mat& buf)
+{
+		const int cn = src.channels();
+		for (int i = 0; i < rows; ++i)
+		{
+				if (rowOf[y0 + i] < 0)
+						continue;
+				const T* in = src.ptr<T>(rowOf[y0 + i]) + c;
+				float* out = buf.ptr<float>(i);
+				for (int j = 0; j < cols; ++j)
+				{
+						const int x = colOf[x0 + j];
+						if (x >= 0)
+								out[j] = (float)in[x * cn];
+				}
+		}
+}
+
+typedef void (*GatherFunc)(const cv::Mat&, const int*, const int*, int, int, int, int, int, cv::Mat&);
+
+inline GatherFunc gatherFor(int depth)
+{
+		switch (depth)
+		{
+		case CV_8U:  return gatherTile<uchar>;
+		case CV_16U: return gatherTile<ushort>;
+		case CV_16S: return gatherTile<short>;
+		case CV_32F: return gatherTile<float>;
+		case CV_64F: return gatherTile<double>;
+		default:
+				CV_Error(cv::Error::StsUnsupportedFormat, "conv::fftFilter: 8U, 16U, 16S, 32F or 64F only");
+		}
+		return 0;
+}
+
+// Rows [y0, y1) of the extended image, channels interleaved, as WT, for spatialFilter
+template<typename T, typename WT>
+void extendRows(const cv::Mat& src, const int* rowOf, const int* colOf, int y0, int y1, int cols, cv::Mat& ext)
+{
+		const int cn = src.channels();
+		for (int i = y0; i < y1; ++i)
+		{
+				WT* out = ext.ptr<WT>(i - y0);
+				if (rowOf[i] < 0)
+				{
+						std::fill(out, out + cols * cn, (WT)0);
+						continue;
+				}
+				const T* in = src.ptr<T>(rowOf[i]);
+				for (int j = 0; j < cols; ++j)
+						for (int c = 0; c < cn; ++c)
+								out[j * cn + c] = colOf[j] < 0 ? (WT)0 : (WT)in[colOf[j] * cn + c];
+		}
+}
+
+// Output rows [y0, y1): for every tap, one multiply-add over a whole row. WT is
+// float, or double for 64F, as in filter2D.
+template<typename T, typename WT>
+void spatialRows(const cv::Mat& src, cv::Mat& dst, const cv::Mat& kernel, const int* rowOf, const int* colOf,
+								 int y0, int y1)
+{
+		const int kh = kernel.rows, kw = kernel.cols, cn = src.channels(), n = src.cols * cn;
+		const int wt = cv::DataType<WT>::depth;
+		cv::Mat ext(y1 - y0 + kh - 1, (src.cols + kw - 1) * cn, wt), k, acc(1, n, wt);
+		extendRows<T, WT>(src, rowOf, colOf, y0, y1 + kh - 1, src.cols + kw - 1, ext);
+		kernel.convertTo(k, wt);
+		WT* a = acc.ptr<WT>();
+		for (int y = y0; y < y1; ++y)
+		{
+				std::fill(a, a + n, (WT)0);
+				for (int i = 0; i < kh; ++i)
+						for (int j = 0; j < kw; ++j)
+						{
+								const WT t = k.at<WT>(i, j);
+								if (t == 0)
+										continue;
+								const WT* in = ext.ptr<WT>(y - y0 + i) + j * cn;
+								for (int x = 0; x < n; ++x)
+										a[x] += t * in[x];
+						}
+				T* out = dst.ptr<T>(y);
+				for (int x = 0; x < n; ++x)
+						out[x] = cv::saturate_cast<T>(a[x]);
+		}
+}
+
+typedef void (*SpatialFunc)(const cv::Mat&, cv::Mat&, const cv::Mat&, const int*, const int*, int, int);
+
+inline SpatialFunc spatialFor(int depth)
+{
+		switch (depth)
+		{
+		case CV_8U:  return spatialRows<uchar, float>;
+		case CV_16U: return spatialRows<ushort, float>;
+		case CV_16S: return spatialRows<short, float>;
+		case CV_32F: return spatialRows<float, float>;
+		case CV_64F: return spatialRows<double, double>;
+		default:
+				CV_Error(cv::Error::StsUnsupportedFormat, "conv::spatialFilter: 8U, 16U, 16S, 32F or 64F only");
+		}
+		return 0;
+}
+} // namespace detail
+
+// Kernel area from which filter2D(src, dst, src.depth(), kernel) runs a DFT
+// instead of the taps (dftFilter2D in OpenCV's imgproc/src/filter.dispatch.cpp)
+inline int filter2DDftArea(int depth)
+{
+		return cv::checkHardwareSupport(CV_CPU_SSE3) && (depth == CV_8U || depth == CV_32F) ? 130 : 50;
+}
+
+// Correlation with the anchor in the kernel centre, kh * kw multiply-adds per
+// value whatever the kernel size. Below filter2DDftArea this is filter2D; above,
+// a direct loop with fftFilter's border handling.
+inline void spatialFilter(const cv::Mat& src, cv::Mat& dst, const cv::Mat& kernel, int borderType = cv::BORDER_REFLECT_101)
+{
+		CV_Assert(!kernel.empty() && kernel.channels() == 1);
+		if ((int)kernel.total() < filter2DDftArea(src.depth()))
+		{
+				cv::filter2D(src, dst, src.depth(), kernel, cv::Point(-1, -1), 0, borderType);
+				return;
+		}
+		const detail::SpatialFunc rows = detail::spatialFor(src.depth());
+		const int H = src.rows, W = src.cols, kh = kernel.rows, kw = kernel.cols;
+		std::vector<int> rowOf(H + kh - 1), colOf(W + kw - 1);
+		for (int i = 0; i < H + kh - 1; ++i)
+				rowOf[i] = cv::borderInterpolate(i - kh / 2, H, borderType);
+		for (int j = 0; j < W + kw - 1; ++j)
+				colOf[j] = cv::borderInterpolate(j - kw / 2, W, borderType);
+
+		// dst may be src: the result goes to a new Mat
+		cv::Mat out(src.size(), src.type());
+		cv::parallel_for_(cv::Range(0, H), [&](const cv::Range& range){
+				rows(src, out, kernel, &rowOf[0], &colOf[0], range.start, range.end);
+		}, (double)src.total() * src.elemSize() * kernel.total() / (1 << 20));
+		dst = out;
+}
+
+// Overlap-add FFT correlation with the anchor in the kernel centre.
+inline void fftFilter(const cv::Mat& src, cv::Mat& dst, const cv::Mat& kernel, int borderType = cv::BORDER_REFLECT_101)
+{
+		CV_Assert(!kernel.empty() && kernel.channels() == 1);
+		const detail::GatherFunc gather = detail::gatherFor(src.depth());
+		const int H = src.rows, W = src.cols, cn = src.channels();
+		const int kh = kernel.rows, kw = kernel.cols, ay = kh / 2, ax = kw / 2;
+
+		// the image extended by the border: (H + kh - 1) x (W + kw - 1); where each of
+		// its rows and columns comes from, -1 for BORDER_CONSTANT's zeros
+		const int PH = H + kh - 1, PW = W + kw - 1;
+		std::vector<int> rowOf(PH), colOf(PW);
+		for (int i = 0; i < PH; ++i)
+				rowOf[i] = cv::borderInterpolate(i - ay, H, borderType);
+		for (int j = 0; j < PW; ++j)
+				colOf[j] = cv::borderInterpolate(j - ax, W, borderType);
+
+		// a correlation is the convolution with the flipped kernel
+		const cv::Size F = fftTileSize(src.size(), kernel.size());
+		const int th = F.height - kh + 1, tw = F.width - kw + 1;   // extended-image pixels per tile
+		cv::Mat k32, flipped;
+		kernel.convertTo(k32, CV_32F);
+		cv::flip(k32, flipped, -1);
+		cv::Mat kernelSpectrum = cv::Mat::zeros(F, CV_32F);
+		cv::Mat corner = kernelSpectrum(cv::Rect(0, 0, kw, kh));
+		flipped.copyTo(corner);
+		cv::dft(kernelSpectrum, kernelSpectrum, 0, kh);
+
+		// the convolution of tile (y0, x0) covers extended rows y0 .. y0 + th + kh - 2,
+		// which is output row y - (kh - 1); the last kh - 1 rows overlap the next tile row
+		cv::Mat acc = cv::Mat::zeros(H, W, CV_32FC(cn));
+		const int tileRows = (PH + th - 1) / th, tileCols = (PW + tw - 1) / tw;
+
+		// tile rows two apart never overlap (th >= kh - 1): the even ones in parallel,
+		// then the odd ones; the tiles of one row go left to right in the same task
+		for (int phase = 0; phase < 2; ++phase)
+		{
+				cv::parallel_for_(cv::Range(0, (tileRows + 1 - phase) / 2), [&](const cv::Range& range){
+						cv::Mat buf(F, CV_32F);
+						for (int r = range.start; r < range.end; ++r)
+						{
+								const int y0 = (2 * r + phase) * th, rows = std::min(th, PH - y0);
+								for (int tc = 0; tc < tileCols; ++tc)
+								{
+										const int x0 = tc * tw, cols = std::min(tw, PW - x0);
+										for (int c = 0; c < cn; ++c)
+										{
+												buf.setTo(cv::Scalar::all(0));
+												gather(src, &rowOf[0], &colOf[0], y0, x0, rows, cols, c, buf);
+
+												cv::dft(buf, buf, 0, rows);
+												cv::mulSpectrums(buf, kernelSpectrum, buf, 0);
+												cv::dft(buf, buf, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+												const int yFirst = std::max(0, kh - 1 - y0), yLast = std::min(rows + kh - 1, H + kh - 1 - y0);
+												const int xFirst = std::max(0, kw - 1 - x0), xLast = std::min(cols + kw - 1, W + kw - 1 - x0);
+												for (int i = yFirst; i < yLast; ++i)
+												{
+														const float* in = buf.ptr<float>(i);
+														float* out = acc.ptr<float>(y0 + i - (kh - 1)) + (x0 - (kw - 1)) * cn + c;
+														for (int j = xFirst; j < xLast; ++j)
+																out[j * cn] += in[j];
+												}
+										}
+								}
+						}
+				});
+		}
+
+		acc.convertTo(dst, src.type());
+}
+
+// dst = filter2D(src, src.depth(), kernel) computed the way method says (METHOD_AUTO: the cheapest)
+inline int filter(const cv::Mat& src, cv::Mat& dst, const cv::Mat& kernel, int method = METHOD_AUTO,
+									int borderType = cv::BORDER_REFLECT_101)
+{
+		cv::Mat kx, ky;
+		const bool separable = separableFactors(kernel, kx, ky);
+		if (method == METHOD_AUTO)
+				method = choose(src.size(), kernel.size(), separable);
+		CV_Assert(method != METHOD_SEPARABLE || separable);
+
+		switch (method)
+		{
+		case METHOD_SPATIAL:
+				spatialFilter(src, dst, kernel, borderType);
+				break;
+		case METHOD_SEPARABLE:
+				cv::sepFilter2D(src, dst, src.depth(), kx, ky, cv::Point(-1, -1), 0, borderType);
+				break;
+		case METHOD_FFT:
+				fftFilter(src, dst, kernel, borderType);
+				break;
+		default:
+				CV_Error(cv::Error::StsBadArg, "conv::filter: unknown method");
+		}
+		return method;
+}
+
+} // namespace conv
+
+#endif // CORE_CONVOLUTION_HPP
@@ -7,11 +7,22 @@
 // transform an image from its spatial domain to its frequency domain
 
 #include "opencv2/core.hpp"
+#include "opencv2/core/utility.hpp"
 #include "opencv2/imgproc.hpp"
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
 
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+
+#include "benchmark.hpp"
 
 using namespace cv;
 using namespace std;
@@ -22,13 +33,37 @@ static void help(char ** argv)
 				<<  "This program demonstrated the use of the discrete Fourier transform (DFT). " << endl
 				<<  "The dft of an image is taken and it's power spectrum is displayed."  << endl << endl
 				<<  "Usage:"                                                                      << endl
-				<< argv[0] << " [image_name -- default lena.jpg]" << endl << endl;
+				<< argv[0] << " [image_name -- default lena.jpg]" << endl
+				<< argv[0] << " --bench [frames -- default 10]   complex vs. real DFT on 8K frames" << endl
+				<< argv[0] << " --welch <image.pgm> [tile -- default 512] [output -- default welch_spectrum.png]" << endl
+				<< "        averaged power spectrum of an image of any size, read tile by tile" << endl << endl;
 }
 
+// log(1 + |DFT(I)|), the way the tutorial does it: a complex image made of I and a zero plane
+Mat complexLogMagnitude(const Mat& I, size_t* peakBytes = 0);
+// the same from the real input, keeping only the half spectrum (CCS) dft() gives for it
+Mat realLogMagnitude(const Mat& I, size_t* peakBytes = 0, double* minVal = 0, double* maxVal = 0);
+// log(1 + |Y|) for the whole spectrum, unpacked from the CCS layout; also its min and max
+void logMagnitudeCCS(const Mat& ccs, Mat& magI, double* minVal = 0, double* maxVal = 0);
+
+// move the origin (0,0) to the centre (rows/2, cols/2), in place, any size;
+// alpha/beta scale every element on the way: m = shift(m) * alpha + beta
+void fftShift(Mat& m, double alpha = 1, double beta = 0);
+// the inverse: the centre goes back to (0,0); the same as fftShift for even sizes
+void ifftShift(Mat& m, double alpha = 1, double beta = 0);
+
+static int benchmarkSpectrum(int frames);
+static int welchCommand(const string& path, int tile, const string& output);
+
 int main(int argc, char ** argv)
 {
 		help(argv);
 
+		if (argc >= 2 && !strcmp(argv[1], "--bench"))
+				return benchmarkSpectrum(argc >= 3 ? atoi(argv[2]) : 10);
+		if (argc >= 3 && !strcmp(argv[1], "--welch"))
+				return welchCommand(argv[2], argc >= 4 ? atoi(argv[3]) : 512, argc >= 5 ? argv[4] : "welch_spectrum.png");
+
 		const char* filename = argc >=2 ? argv[1] : "lena.jpg";
 
 		Mat I = imread( samples::findFile( filename ), IMREAD_GRAYSCALE);
@@ -38,6 +73,32 @@ int main(int argc, char ** argv)
 				return EXIT_FAILURE;
 		}
 
+		double minVal, maxVal;
+		Mat magI = realLogMagnitude(I, 0, &minVal, &maxVal);
+
+//! [shift_normalize]
+		// rearrange the quadrants of Fourier image so that the origin is at the image center.
+		// Odd sizes are shifted too, nothing is cropped, and the values are scaled to
+		// [0, 1] for imshow while they are moved (what normalize(NORM_MINMAX) did).
+		const double range = maxVal > minVal ? maxVal - minVal : 1;
+		fftShift(magI, 1 / range, -minVal / range);
+//! [shift_normalize]
+
+		imshow("Input Image"       , I   );    // Show the result
+		imshow("spectrum magnitude", magI);
+		waitKey();
+
+		return EXIT_SUCCESS;
+}
+
+// bytes of the buffer behind m
+static size_t bytesOf(const Mat& m)
+{
+		return m.total() * m.elemSize();
+}
+
+Mat complexLogMagnitude(const Mat& I, size_t* peakBytes)
+{
 //The performance of a DFT is dependent of the image size.
 //It tends to be the fastest for image sizes that are multiple of the numbers two, three and five.
 //Therefore, to achieve maximal performance it is generally a good idea to pad border values to the image to get a size with such traits.
@@ -76,53 +137,512 @@ int main(int argc, char ** argv)
 		Mat magI = planes[0];
 //! [magnitude]
 
+		// everything above is still alive here
+		if (peakBytes)
+				*peakBytes = bytesOf(padded) + bytesOf(planes[0]) + bytesOf(planes[1]) + bytesOf(complexI);
+
 //! [log]
 		magI += Scalar::all(1);                    // switch to logarithmic scale
 		log(magI, magI);
 //! [log]
+		return magI;
+}
 
-//! [crop_rearrange]
-		// crop the spectrum, if it has an odd number of rows or columns
-		// bitwise and with -2
-		// There are three steps necessary to convert a negative decimal integer to two’s complement form:
-		// 1. Start with the positive binary value, expanded to fill the number of bits you will be storing the number into.
-		// 0000000000010
-		// 2. Complement/flip all of the bits. This means all of the 1s become 0s and all of the 0s become 1s
-		// 1111111111101
-		// 3. Add one to the flipped bits.
-		// 1111111111110
-
-		// -1 twice from 0000000000000
-
-		magI = magI(Rect(0, 0, magI.cols & -2, magI.rows & -2));
-
-		// rearrange the quadrants of Fourier image  so that the origin is at the image center
-		int cx = magI.cols/2;
-		int cy = magI.rows/2;
-
-		Mat q0(magI, Rect(0, 0, cx, cy));   // Top-Left - Create a ROI per quadrant
-		Mat q1(magI, Rect(cx, 0, cx, cy));  // Top-Right
-		Mat q2(magI, Rect(0, cy, cx, cy));  // Bottom-Left
-		Mat q3(magI, Rect(cx, cy, cx, cy)); // Bottom-Right
-
-		Mat tmp;                           // swap quadrants (Top-Left with Bottom-Right)
-		q0.copyTo(tmp);
-		q3.copyTo(q0);
-		tmp.copyTo(q3);
-
-		q1.copyTo(tmp);                    // swap quadrant (Top-Right with Bottom-Left)
-		q2.copyTo(q1);
-		tmp.copyTo(q2);
-//! [crop_rearrange]
-
-//! [normalize]
-		normalize(magI, magI, 0, 1, NORM_MINMAX); // Transform the matrix with float values into a
-																						// viewable image form (float between values 0 and 1).
-//! [normalize]
+// dft() of a real single-channel image is real too: the spectrum of a real
+// signal is Hermitian, Y(u,v) = conj(Y(-u,-v)), so only half of it is stored,
+// packed in the same M x N floats (CCS, see the dft() documentation).
+// No zero plane, no merge, no split, and the transform does about half the work.
+Mat realLogMagnitude(const Mat& I, size_t* peakBytes, double* minVal, double* maxVal)
+{
+//! [expand_real]
+		// pad and convert to float in one go: the input goes straight into the top-left corner
+		Mat padded = Mat::zeros(getOptimalDFTSize( I.rows ), getOptimalDFTSize( I.cols ), CV_32F);
+		Mat inside = padded(Rect(0, 0, I.cols, I.rows));
+		I.convertTo(inside, CV_32F);
+//! [expand_real]
 
-		imshow("Input Image"       , I   );    // Show the result
-		imshow("spectrum magnitude", magI);
-		waitKey();
+//! [dft_real]
+		dft(padded, padded);                // real input, CCS-packed output, in place
+//! [dft_real]
+
+//! [log_magnitude_ccs]
+		Mat magI;
+		logMagnitudeCCS(padded, magI, minVal, maxVal);
+//! [log_magnitude_ccs]
+
+		if (peakBytes)
+				*peakBytes = bytesOf(padded) + bytesOf(magI);
+		return magI;
+}
 
+namespace
+{
+// |Y(u,c)|^2 for c = 0 (or c = N/2, packed in the last column): these two columns of the
+// spectrum are the DFTs of real columns, stored as Re/Im pairs going down the column
+inline float packedColumnSquared(const Mat& ccs, const int u, const int c)
+{
+		const int M = ccs.rows;
+		if (u == 0)
+				return ccs.at<float>(0, c) * ccs.at<float>(0, c);
+		if (M % 2 == 0 && u == M / 2)
+				return ccs.at<float>(M - 1, c) * ccs.at<float>(M - 1, c);
+		const int k = u <= M / 2 ? u : M - u;  // Y(M-k) = conj(Y(k))
+		const float re = ccs.at<float>(2 * k - 1, c), im = ccs.at<float>(2 * k, c);
+		return re * re + im * im;
+}
+
+// op(out[v], |Y(u,v)|^2) for the whole row u of the M x N spectrum
+template<typename Op>
+inline void unpackRowCCS(const Mat& ccs, const int u, float* out, Op op)
+{
+		const int M = ccs.rows, N = ccs.cols;
+		op(out[0], packedColumnSquared(ccs, u, 0));
+		if (N % 2 == 0)
+				op(out[N / 2], packedColumnSquared(ccs, u, N - 1));
+
+		// the other columns 1..(N-1)/2 are Re/Im pairs; column N-v is the
+		// mirror: |Y(u, N-v)| = |Y(M-u, v)|
+		const float* row = ccs.ptr<float>(u);
+		const float* mirror = ccs.ptr<float>((M - u) % M);
+		for (int v = 1; v < (N + 1) / 2; ++v)
+		{
+				op(out[v], row[2*v - 1] * row[2*v - 1] + row[2*v] * row[2*v]);
+				op(out[N - v], mirror[2*v - 1] * mirror[2*v - 1] + mirror[2*v] * mirror[2*v]);
+		}
+}
+}
+
+void logMagnitudeCCS(const Mat& ccs, Mat& magI, double* minVal, double* maxVal)
+{
+		CV_Assert(ccs.type() == CV_32FC1);
+		const int M = ccs.rows, N = ccs.cols;
+		magI.create(M, N, CV_32F);
+
+		// the range for the normalization is collected here, so it costs no extra pass
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		std::mutex rangeMutex;
+
+		// every output row reads its own packed row and its mirror; rows are independent
+		parallel_for_(Range(0, M), [&](const Range& range){
+				for (int u = range.start; u < range.end; ++u)
+						unpackRowCCS(ccs, u, magI.ptr<float>(u), [](float& out, float squared){
+								out = std::log1p(std::sqrt(squared));
+						});
+
+				if (!minVal && !maxVal)
+						return;
+				float stripeLo = FLT_MAX, stripeHi = -FLT_MAX;
+				for (int u = range.start; u < range.end; ++u)
+				{
+						const float* out = magI.ptr<float>(u);  // still in cache
+						for (int v = 0; v < N; ++v)
+						{
+								stripeLo = min(stripeLo, out[v]);
+								stripeHi = max(stripeHi, out[v]);
+						}
+				}
+				std::lock_guard<std::mutex> lock(rangeMutex);
+				lo = min(lo, stripeLo);
+				hi = max(hi, stripeHi);
+		}, (double)M * N / (1 << 16));
+
+		if (minVal)
+				*minVal = lo;
+		if (maxVal)
+				*maxVal = hi;
+}
+
+//************* [fft_shift] *****************
+namespace
+{
+inline void scaleRow(float* row, const int n, const float alpha, const float beta)
+{
+		for (int x = 0; x < n; ++x)
+				row[x] = row[x] * alpha + beta;
+}
+
+// cyclic shift of m by (dy, dx) in place: element (i,j) goes to ((i+dy) % rows, (j+dx) % cols)
+void cyclicShift(Mat& m, const int dy, const int dx, const double alpha, const double beta)
+{
+		CV_Assert(m.depth() == CV_32F);
+		const int M = m.rows, cn = m.channels(), width = m.cols * cn;
+		const float a = (float)alpha, b = (float)beta;
+		const bool scale = alpha != 1 || beta != 0;
+		const double nstripes = (double)m.total() * m.elemSize() / (1 << 16);
+
+		if (M % 2 == 0 && m.cols % 2 == 0 && dy == M / 2 && dx == m.cols / 2)
+		{
+				// even sizes: (i,j) and (i+M/2, j+N/2) trade places, one pass, no buffer
+				const int half = width / 2;
+				parallel_for_(Range(0, M / 2), [&](const Range& range){
+						for (int i = range.start; i < range.end; ++i)
+						{
+								float* top = m.ptr<float>(i);
+								float* bottom = m.ptr<float>(i + M / 2);
+								for (int x = 0; x < half; ++x)
+								{
+										const float t0 = top[x], t1 = top[x + half];
+										top[x] = bottom[x + half] * a + b;
+										top[x + half] = bottom[x] * a + b;
+										bottom[x + half] = t0 * a + b;
+										bottom[x] = t1 * a + b;
+								}
+						}
+				}, nstripes);
+				return;
+		}
+
+		// 1. every row rotated right by dx pixels (and scaled while it is in cache)
+		parallel_for_(Range(0, M), [&](const Range& range){
+				for (int i = range.start; i < range.end; ++i)
+				{
+						float* row = m.ptr<float>(i);
+						std::rotate(row, row + width - dx * cn, row + width);
+						if (scale)
+								scaleRow(row, width, a, b);
+				}
+		}, nstripes);
+
+		// 2. the rows moved down by dy: the permutation i -> (i+dy) % M splits into
+		// gcd(M, dy) cycles; each is followed with one saved row, one block of
+		// columns at a time, and the column blocks run in parallel
+		if (dy % M == 0)
+				return;
+		int cycles = M, step = dy;
+		while (step)
+		{
+				const int r = cycles % step;
+				cycles = step;
+				step = r;
+		}
+		const int block = 1024;
+		parallel_for_(Range(0, (width + block - 1) / block), [&](const Range& range){
+				float saved[block];
+				for (int blk = range.start; blk < range.end; ++blk)
+				{
+						const int x0 = blk * block, n = min(block, width - x0);
+						for (int start = 0; start < cycles; ++start)
+						{
+								std::copy(m.ptr<float>(start) + x0, m.ptr<float>(start) + x0 + n, saved);
+								int to = start;
+								for (int from = (to - dy + M) % M; from != start; from = (to - dy + M) % M)
+								{
+										std::copy(m.ptr<float>(from) + x0, m.ptr<float>(from) + x0 + n, m.ptr<float>(to) + x0);
+										to = from;
+								}
+								std::copy(saved, saved + n, m.ptr<float>(to) + x0);
+						}
+				}
+		}, nstripes);
+}
+}
+
+void fftShift(Mat& m, double alpha, double beta)
+{
+		cyclicShift(m, m.rows / 2, m.cols / 2, alpha, beta);
+}
+
+void ifftShift(Mat& m, double alpha, double beta)
+{
+		cyclicShift(m, m.rows - m.rows / 2, m.cols - m.cols / 2, alpha, beta);
+}
+
+//************* [fft_context] *****************
+// What a stream of same-size transforms keeps from one frame to the next.
+// There is one plan per (rows, cols, type) of input: the optimal DFT size, the
+// padded buffer the transform runs in and the log-magnitude buffer. After the
+// first frame of a size, this code allocates nothing more (dft() still uses its
+// own scratch memory; OpenCV keeps its twiddle factors to itself).
+// Not thread-safe: one context per stream.
+class FFTContext
+{
+public:
+		FFTContext() : m_allocations(0)
+		{}
+
+		// real DFT of I, CCS-packed like realLogMagnitude's; the buffer belongs to the context
+		const Mat& forward(const Mat& I)
+		{
+				return transform(I).padded;
+		}
+
+		// log(1 + |DFT(I)|) and its range, see logMagnitudeCCS
+		const Mat& logMagnitude(const Mat& I, double* minVal = 0, double* maxVal = 0)
+		{
+				Plan& p = transform(I);
+				logMagnitudeCCS(p.padded, p.magnitude, minVal, maxVal);
+				track(p.magnitude, p.magnitudeData);
+				return p.magnitude;
+		}
+
+		// buffers allocated so far: two per plan, anything more is a bug
+		size_t allocations() const { return m_allocations; }
+		size_t plans() const { return m_plans.size(); }
+
+private:
+		struct Key
+		{
+				int rows, cols, type;
+				bool operator<(const Key& k) const
+				{
+						return rows != k.rows ? rows < k.rows : cols != k.cols ? cols < k.cols : type < k.type;
+				}
+		};
+
+		struct Plan
+		{
+				Mat padded;     // getOptimalDFTSize() of the input, the transform runs in place here
+				Mat magnitude;
+				const uchar* paddedData;
+				const uchar* magnitudeData;
+		};
+
+		Plan& plan(const Mat& I)
+		{
+				CV_Assert(I.channels() == 1);
+				const Key key = { I.rows, I.cols, I.type() };
+				map<Key, Plan>::iterator it = m_plans.find(key);
+				if (it == m_plans.end())
+				{
+						Plan p;
+						p.padded.create(getOptimalDFTSize( I.rows ), getOptimalDFTSize( I.cols ), CV_32F);
+						p.magnitude.create(p.padded.size(), CV_32F);
+						p.paddedData = p.padded.data;
+						p.magnitudeData = p.magnitude.data;
+						m_allocations += 2;
+						it = m_plans.insert(make_pair(key, p)).first;
+				}
+				return it->second;
+		}
+
+		Plan& transform(const Mat& I)
+		{
+				Plan& p = plan(I);
+
+				// the last transform ran in place, so the padding has to be cleared again
+				if (p.padded.cols > I.cols)
+						p.padded(Rect(I.cols, 0, p.padded.cols - I.cols, I.rows)).setTo(Scalar::all(0));
+				if (p.padded.rows > I.rows)
+						p.padded.rowRange(I.rows, p.padded.rows).setTo(Scalar::all(0));
+				Mat inside = p.padded(Rect(0, 0, I.cols, I.rows));
+				I.convertTo(inside, CV_32F);
+
+				// only the first I.rows rows are non-zero: dft() skips the rest of the row transforms
+				dft(p.padded, p.padded, 0, I.rows);
+				track(p.padded, p.paddedData);
+				return p;
+		}
+
+		// counts a buffer that was reallocated behind our back
+		void track(const Mat& m, const uchar*& data)
+		{
+				if (m.data != data)
+				{
+						data = m.data;
+						++m_allocations;
+				}
+		}
+
+		map<Key, Plan> m_plans;
+		size_t m_allocations;
+};
+
+// Times both pipelines on 8K (7680 x 4320) grayscale frames and prints the buffers
+// each one holds at its peak (dft's own scratch memory not included).
+static int benchmarkSpectrum(int frames)
+{
+		Mat frame(4320, 7680, CV_8UC1);
+		randu(frame, Scalar::all(0), Scalar::all(256));
+
+		size_t complexBytes = 0, realBytes = 0;
+		Mat complexMag = complexLogMagnitude(frame, &complexBytes);
+		Mat realMag = realLogMagnitude(frame, &realBytes);
+
+		bench::Options options;
+		options.warmup = 1;
+		options.iterations = max(1, frames);
+		bench::Benchmark benchmark("dft 7680x4320", options);
+		const double bytes = (double)bytesOf(frame);
+		const bench::Result c = benchmark.run("complex (merge, dft, split)", bytes, [&]{ complexMag = complexLogMagnitude(frame); });
+		const bench::Result r = benchmark.run("real (CCS half spectrum)", bytes, [&]{ realMag = realLogMagnitude(frame); });
+
+		// a video stream: the same size every frame, buffers kept in the context
+		FFTContext context;
+		context.logMagnitude(frame);
+		const size_t firstFrame = context.allocations();
+		const bench::Result k = benchmark.run("real, cached FFTContext", bytes, [&]{ context.logMagnitude(frame); });
+		benchmark.print(cout);
+
+		cout << fixed << setprecision(1)
+				<< "peak buffers: complex " << complexBytes / 1048576.0 << " MB, real " << realBytes / 1048576.0
+				<< " MB (" << 100.0 * (1.0 - (double)realBytes / complexBytes) << "% less)" << endl
+				<< "median time:  complex " << c.medianMs << " ms, real " << r.medianMs
+				<< " ms (" << c.medianMs / r.medianMs << "x), cached context " << k.medianMs
+				<< " ms (" << c.medianMs / k.medianMs << "x)" << endl
+				<< "FFTContext: " << context.allocations() - firstFrame << " buffers allocated in "
+				<< options.warmup + options.iterations << " frames after the first" << endl
+				<< setprecision(6) << "max difference of the log spectra: " << norm(complexMag, realMag, NORM_INF)
+				<< ", cached context: " << norm(realMag, context.logMagnitude(frame), NORM_INF) << endl;
+		return EXIT_SUCCESS;
+}
+
+//************* [welch] *****************
+// A binary PGM (P5) image read one block at a time: only the header is parsed
+// up front, read() seeks to every row it needs. 8 or 16 bits per pixel.
+class PgmReader
+{
+public:
+		PgmReader() : m_data(0), m_bytes(0)
+		{}
+
+		bool open(const string& path)
+		{
+				m_file.open(path.c_str(), ios::binary);
+				string magic;
+				int maxval = 0;
+				if (!(m_file >> magic) || magic != "P5")
+						return false;
+				if (!readNumber(m_size.width) || !readNumber(m_size.height) || !readNumber(maxval))
+						return false;
+				m_file.get();  // the single whitespace before the pixels
+				m_data = m_file.tellg();
+				m_bytes = maxval < 256 ? 1 : 2;
+				return m_size.width > 0 && m_size.height > 0 && maxval > 0 && maxval < 65536;
+		}
+
+		Size size() const { return m_size; }
+		int type() const { return m_bytes == 1 ? CV_8UC1 : CV_16UC1; }
+
+		bool read(const Rect& r, Mat& block)
+		{
+				block.create(r.size(), type());
+				for (int i = 0; i < r.height; ++i)
+				{
+						m_file.seekg(m_data + ((streamoff)(r.y + i) * m_size.width + r.x) * m_bytes);
+						if (!m_file.read((char*)block.ptr(i), (streamsize)r.width * m_bytes))
+								return false;
+						if (m_bytes == 2)
+						{
+								// 16-bit PGM is big-endian
+								ushort* p = block.ptr<ushort>(i);
+								for (int j = 0; j < r.width; ++j)
+										p[j] = (ushort)((p[j] >> 8) | (p[j] << 8));
+						}
+				}
+				return true;
+		}
+
+private:
+		// a header field, after whitespace and # comments
+		bool readNumber(int& value)
+		{
+				for (int c = m_file.peek(); c == '#' || isspace(c); c = m_file.peek())
+				{
+						string comment;
+						if (c == '#')
+								getline(m_file, comment);
+						else
+								m_file.get();
+				}
+				return (bool)(m_file >> value);
+		}
+
+		ifstream m_file;
+		streamoff m_data;
+		Size m_size;
+		int m_bytes;
+};
+
+// log of the average power, origin in the centre, stretched to 8 bits. Written to a
+// temporary file that is then renamed, so a viewer never sees half an image.
+static bool writeWelchSpectrum(const Mat& power, double scale, const string& output)
+{
+		Mat logPower;
+		power.convertTo(logPower, CV_32F, 1.0 / scale);
+		max(logPower, FLT_MIN, logPower);
+		log(logPower, logPower);
+
+		double lo, hi;
+		minMaxLoc(logPower, &lo, &hi);
+		const double range = hi > lo ? hi - lo : 1;
+		fftShift(logPower, 255 / range, -255 * lo / range);
+
+		Mat image;
+		logPower.convertTo(image, CV_8U);
+		const string partial = output + ".partial.png";
+		return imwrite(partial, image) && std::rename(partial.c_str(), output.c_str()) == 0;
+}
+
+// Welch's method: the power spectrum averaged over tile x tile blocks that overlap
+// by half, each with its mean removed and a Hann window applied. The image is
+// never loaded: every task reads its own blocks from the file, so memory is a few
+// tile-sized buffers per thread whatever the image size. The average so far is
+// written out after every row of tiles.
+static int welchCommand(const string& path, const int tile, const string& output)
+{
+		PgmReader header;
+		if (!header.open(path))
+		{
+				cerr << path << " is not a binary PGM (P5) image" << endl;
+				return EXIT_FAILURE;
+		}
+		const Size size = header.size();
+		if (tile < 8 || tile > size.width || tile > size.height)
+		{
+				cerr << "the tile must be at least 8 and fit in the " << size.width << "x" << size.height << " image" << endl;
+				return EXIT_FAILURE;
+		}
+
+		Mat window;
+		createHanningWindow(window, Size(tile, tile), CV_32F);
+		const double windowPower = sum(window.mul(window))[0];
+
+		const int step = tile / 2;
+		const int tilesX = (size.width - tile) / step + 1, tilesY = (size.height - tile) / step + 1;
+		const double tileMB = tile * tile * 4.0 / (1 << 20);
+		cout << size.width << "x" << size.height << ", " << tilesX << "x" << tilesY << " tiles of " << tile << "x" << tile
+				<< ", about " << fixed << setprecision(1) << (3 + 3 * getNumThreads()) * tileMB << " MB of buffers" << endl;
+
+		Mat power = Mat::zeros(tile, tile, CV_32F);
+		std::mutex powerMutex;
+		bool failed = false;
+		int64 t = getTickCount();
+		for (int ty = 0; ty < tilesY && !failed; ++ty)
+		{
+				parallel_for_(Range(0, tilesX), [&](const Range& range){
+						PgmReader reader;  // a file position of its own
+						Mat block, spectrum, partial = Mat::zeros(tile, tile, CV_32F);
+						bool ok = reader.open(path);
+						for (int tx = range.start; ok && tx < range.end; ++tx)
+						{
+								ok = reader.read(Rect(tx * step, ty * step, tile, tile), block);
+								block.convertTo(spectrum, CV_32F);
+								// without its mean the tile's DC does not leak into the low frequencies through the window
+								subtract(spectrum, mean(spectrum), spectrum);
+								multiply(spectrum, window, spectrum);
+								dft(spectrum, spectrum);
+								for (int u = 0; u < tile; ++u)
+										unpackRowCCS(spectrum, u, partial.ptr<float>(u), [](float& out, float squared){
+												out += squared;
+										});
+						}
+						std::lock_guard<std::mutex> lock(powerMutex);
+						power += partial;
+						failed = failed || !ok;
+				});
+
+				if (!writeWelchSpectrum(power, (double)(ty + 1) * tilesX * windowPower, output))
+						failed = true;
+				cout << "\rrow " << ty + 1 << "/" << tilesY << " of tiles, "
+						<< setprecision(1) << (getTickCount() - t) / getTickFrequency() << " s" << flush;
+		}
+		cout << endl;
+
+		if (failed)
+		{
+				cerr << "reading " << path << " or writing " << output << " failed" << endl;
+				return EXIT_FAILURE;
+		}
+		cout << "spectrum written to " << output << endl;
 		return EXIT_SUCCESS;
 }
@@ -14,7 +14,13 @@ sometimes these parameters are said to control "contrast" and "brightness" respe
 
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "point_ops.hpp"
 
 // we're NOT "using namespace std;" here, to avoid collisions between the beta variable and std::beta in c++17
 using std::cin;
@@ -22,6 +28,11 @@ using std::cout;
 using std::endl;
 using namespace cv;
 
+void gainBiasLoop(const Mat& image, Mat& new_image, double alpha, int beta);
+static int benchmarkGainBias();
+static int benchmarkToneCurve();
+static int benchmarkPacked();
+
 /**
  * @function main
  * @brief Main function
@@ -37,7 +48,15 @@ int main( int argc, char** argv )
 		//      ^         :to mark argument as positional, prefix it with the @ symbol
 		//A positional argument is a name that is not followed by an equal sign (=) and default value.
 		//A keyword argument is followed by an equal sign and an expression that gives its default value.
-		CommandLineParser parser( argc, argv, "{@input | lena.jpg | input image}" );
+		CommandLineParser parser( argc, argv, "{@input | lena.jpg | input image}"
+				"{gamma | 1.0 | gamma correction applied after the gain and the bias}"
+				"{bench | | time point::gainBias against convertTo and the loop, fused tone curves and packed RAW frames}" );
+		if( parser.has( "bench" ) )
+		{
+			benchmarkGainBias();
+			benchmarkToneCurve();
+			return benchmarkPacked();
+		}
 		Mat image = imread( samples::findFile( parser.get<String>( "@input" ) ) );
 		if( image.empty() )
 		{
@@ -63,18 +82,19 @@ int main( int argc, char** argv )
 		//! [basic-linear-transform-parameters]
 
 		/// Do the operation new_image(i,j) = alpha*image(i,j) + beta
-		/// Instead of these 'for' loops we could have used simply:
-		/// image.convertTo(new_image, -1, alpha, beta);
-		/// but we wanted to show you how to access the pixels :)
+		/// An 8-bit pixel has only 256 possible values, so point::gainBias computes
+		/// alpha*v + beta once for each of them and looks every pixel up in that
+		/// table, on all the threads. gainBiasLoop below is the same per pixel.
 		//! [basic-linear-transform-operation]
-		for( int y = 0; y < image.rows; y++ ) {
-				for( int x = 0; x < image.cols; x++ ) {
-						for( int c = 0; c < image.channels(); c++ ) {
-								new_image.at<Vec3b>(y,x)[c] =
-									// use saturate_cast to make sure the value is valid
-									saturate_cast<uchar>( alpha*image.at<Vec3b>(y,x)[c] + beta );
-						}
-				}
+		const double gamma = parser.get<double>( "gamma" );
+		if( gamma == 1.0 )
+		{
+			point::gainBias( image, new_image, alpha, beta );
+		}
+		else
+		{
+			// still a single table: gain, bias and gamma are evaluated once per value
+			point::ToneCurve().gain( alpha ).bias( beta ).gamma( gamma ).apply( image, new_image );
 		}
 		//! [basic-linear-transform-operation]
 
@@ -88,3 +108,173 @@ int main( int argc, char** argv )
 		//! [basic-linear-transform-display]
 		return 0;
 }
+
+// the tutorial's loop, kept as the reference for the benchmark
+/// Instead of these 'for' loops we could have used simply:
+/// image.convertTo(new_image, -1, alpha, beta);
+/// but we wanted to show you how to access the pixels :)
+void gainBiasLoop(const Mat& image, Mat& new_image, double alpha, int beta)
+{
+		for( int y = 0; y < image.rows; y++ ) {
+				for( int x = 0; x < image.cols; x++ ) {
+						for( int c = 0; c < image.channels(); c++ ) {
+								new_image.at<Vec3b>(y,x)[c] =
+									// use saturate_cast to make sure the value is valid
+									saturate_cast<uchar>( alpha*image.at<Vec3b>(y,x)[c] + beta );
+						}
+				}
+		}
+}
+
+// BGR frames from VGA to 8K: the loop, convertTo and point::gainBias into a
+// second image and in place
+static int benchmarkGainBias()
+{
+		const double alpha = 2.2;
+		const int beta = 50;
+		const Size sizes[] = { Size(640, 480), Size(1920, 1080), Size(3840, 2160), Size(7680, 4320) };
+
+		bench::Options options;
+		options.warmup = 2;
+		options.iterations = 20;
+		bench::Benchmark benchmark("gain/bias", options);
+		for( size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++ )
+		{
+				Mat image( sizes[s], CV_8UC3 ), reference( sizes[s], CV_8UC3 ), new_image, work;
+				randu( image, Scalar::all(0), Scalar::all(256) );
+				const double bytes = (double)image.total() * image.elemSize();
+				std::ostringstream size;
+				size << sizes[s].width << "x" << sizes[s].height;
+
+				const bench::Result loop = benchmark.run( "loop " + size.str(), bytes, [&]{ gainBiasLoop( image, reference, alpha, beta ); } );
+				const bench::Result convert = benchmark.run( "convertTo " + size.str(), bytes, [&]{ image.convertTo( new_image, -1, alpha, beta ); } );
+				const bench::Result lut = benchmark.run( "point::gainBias " + size.str(), bytes, [&]{ point::gainBias( image, new_image, alpha, beta ); } );
+				const double errors = norm( reference, new_image, NORM_INF );
+				benchmark.run( "point::gainBias in place " + size.str(), bytes,
+						[&]{ image.copyTo( work ); },
+						[&]{ point::gainBias( work, alpha, beta ); } );
+
+				cout << size.str() << ": " << std::fixed << std::setprecision(2)
+						<< loop.medianMs / lut.medianMs << "x the loop, " << convert.medianMs / lut.medianMs
+						<< "x convertTo, max difference " << errors << endl;
+		}
+		cout << endl;
+		benchmark.print(cout);
+		return 0;
+}
+
+// An exposure correction of five steps (gain, bias, gamma, clamp to video range,
+// S-curve) on 1080p BGR frames, 8 and 16 bits: each step as its own pass over
+// the frame against the whole chain in one pass.
+static int benchmarkToneCurve()
+{
+		const double white[] = { 255, 65535 };
+		const int types[] = { CV_8UC3, CV_16UC3 };
+
+		bench::Options options;
+		options.warmup = 2;
+		options.iterations = 20;
+		bench::Benchmark benchmark("tone curve", options);
+		for( int d = 0; d < 2; d++ )
+		{
+				const double w = white[d];
+				std::vector<Point2d> sCurve;
+				sCurve.push_back( Point2d( 0, 0 ) );
+				sCurve.push_back( Point2d( 0.25*w, 0.2*w ) );
+				sCurve.push_back( Point2d( 0.75*w, 0.8*w ) );
+				sCurve.push_back( Point2d( w, w ) );
+
+				std::vector<point::ToneCurve> steps( 5 );
+				steps[0].gain( 1.2 );
+				steps[1].bias( -0.04*w );
+				steps[2].gamma( 1/2.2, w );
+				steps[3].clamp( 16/255.0*w, 235/255.0*w );
+				steps[4].curve( sCurve );
+				point::ToneCurve chain;
+				chain.gain( 1.2 ).bias( -0.04*w ).gamma( 1/2.2, w ).clamp( 16/255.0*w, 235/255.0*w ).curve( sCurve );
+
+				Mat image( 1080, 1920, types[d] ), fused, work;
+				randu( image, Scalar::all(0), Scalar::all(w + 1) );
+				const double bytes = (double)image.total() * image.elemSize();
+				const std::string depth = d == 0 ? " 8U" : " 16U";
+
+				const bench::Result passes = benchmark.run( "5 passes" + depth, bytes, [&]{
+						steps[0].apply( image, work );
+						for( size_t i = 1; i < steps.size(); i++ )
+								steps[i].apply( work, work );
+				} );
+				const bench::Result once = benchmark.run( "fused chain" + depth, bytes, [&]{ chain.apply( image, fused ); } );
+
+				// the 8-bit steps round after every pass, the fused table only once
+				cout << "1920x1080" << depth << ": " << std::fixed << std::setprecision(2)
+						<< passes.medianMs / once.medianMs << "x faster fused, max difference to the passes "
+						<< norm( fused, work, NORM_INF );
+				if( d == 1 )
+				{
+						// the 16-bit cubic against the exact chain, every input code
+						Mat codes( 256, 256, CV_16UC1 ), fitted;
+						for( int i = 0; i < 65536; i++ )
+								codes.at<ushort>( i / 256, i % 256 ) = (ushort)i;
+						chain.apply( codes, fitted );
+						int worst = 0;
+						for( int i = 0; i < 65536; i++ )
+								worst = std::max( worst, std::abs( fitted.at<ushort>( i / 256, i % 256 ) - saturate_cast<ushort>( chain( i ) ) ) );
+						cout << ", fit error " << worst << " codes";
+				}
+				cout << endl;
+		}
+		cout << endl;
+		benchmark.print(cout);
+		return 0;
+}
+
+// 4K frames in the packed camera formats through gain, bias and clamp: unpack
+// to 16 bits, process, pack (three passes and a 16-bit frame in between)
+// against point::applyPacked
+static int benchmarkPacked()
+{
+		const int formats[] = { point::PACKED_RAW10, point::PACKED_RAW12, point::PACKED_P010 };
+		const char* names[] = { "RAW10", "RAW12", "P010" };
+		const int width = 3840, height = 2160;
+
+		bench::Options options;
+		options.warmup = 2;
+		options.iterations = 20;
+		bench::Benchmark benchmark("packed", options);
+		for( int f = 0; f < 3; f++ )
+		{
+				const int format = formats[f];
+				const double top = (1 << point::packedBits( format )) - 1;
+				point::ToneCurve curve;
+				curve.gain( 1.5 ).bias( -0.05*top ).clamp( 0.0625*top, 0.92*top );
+				std::vector<int> table( (size_t)top + 1 );
+				curve.table( point::packedBits( format ), &table[0] );
+
+				Mat frame( height, point::packedCols( format, width ), format == point::PACKED_P010 ? CV_16UC1 : CV_8UC1 );
+				randu( frame, Scalar::all(0), Scalar::all(format == point::PACKED_P010 ? 1024 : 256) );
+				if( format == point::PACKED_P010 )
+						frame *= 64;   // the 10 bits at the top of the word
+				const double bytes = (double)frame.total() * frame.elemSize();
+
+				Mat samples, threePass, fused;
+				const bench::Result passes = benchmark.run( std::string( "unpack, LUT, pack " ) + names[f], bytes, [&]{
+						point::unpackPacked( frame, format, samples );
+						point::forEachRun<ushort, ushort>( samples, samples, [&]( const ushort* in, ushort* out, int n ){
+								for( int j = 0; j < n; j++ )
+										out[j] = (ushort)table[in[j]];
+						} );
+						point::packPacked( samples, format, threePass );
+				} );
+				const bench::Result once = benchmark.run( std::string( "applyPacked " ) + names[f], bytes, [&]{
+						point::applyPacked( frame, fused, format, &table[0] );
+				} );
+
+				cout << names[f] << " " << width << "x" << height << ": " << std::fixed << std::setprecision(2)
+						<< passes.medianMs / once.medianMs << "x faster fused, "
+						<< samples.total() * samples.elemSize() / 1048576.0 << " MB 16-bit frame saved, max difference "
+						<< norm( threePass, fused, NORM_INF ) << endl;
+		}
+		cout << endl;
+		benchmark.print(cout);
+		return 0;
+}
@@ -1,7 +1,19 @@
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+
+#include "benchmark.hpp"
+#include "convolution.hpp"
+#include "stencil.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 using namespace std;
 using namespace cv;
@@ -29,17 +41,26 @@ static void help(char* progName)
 				<<  "This program shows how to filter images with mask: the write it yourself and the"
 				<< "filter2d way. " << endl
 				<<  "Usage:"                                                                        << endl
-				<< progName << " [image_path -- default lena.jpg] [G -- grayscale] "        << endl << endl;
+				<< progName << " [image_path -- default lena.jpg] [G -- grayscale] [--sweep]" << endl
+				<< "--sweep times spatial, separable and FFT convolution for kernels up to 63x63"  << endl << endl;
 }
 
 //declare fucntion Sharpen
 void Sharpen(const Mat& myImage,Mat& Result);
+// vectorized, multi-threaded version with real border handling
+void SharpenFast(const Mat& myImage, Mat& Result, int borderType = BORDER_REFLECT_101);
+// where FFT convolution starts to beat spatial / separable filtering on this machine
+static int convolutionSweep(const Mat& src);
 
 // argc: (argument count) number of strings pointed by argv
 // argv: (argument vector) array of  pointer
 int main( int argc, char* argv[])
 {
 		help(argv[0]);
+		// --sweep comes last, the other arguments keep their places
+		const bool sweep = argc >= 2 && !strcmp(argv[argc - 1], "--sweep");
+		if (sweep)
+				--argc;
 		// “？ ：” condition operator
 		// if argc >= 2 filename = argv[1] (pointer to a char)(array of char)
 		// else filename = "lena.jpg"
@@ -61,6 +82,8 @@ int main( int argc, char* argv[])
 				return EXIT_FAILURE;
 		}
 
+		if (sweep)
+				return convolutionSweep(src);
 
 
 		namedWindow("Input", WINDOW_AUTOSIZE);
@@ -77,6 +100,30 @@ int main( int argc, char* argv[])
 		imshow( "Output", dst0 );
 		waitKey();
 
+	//*********** [SharpenFast ]**************
+
+		Mat dst2;
+		t = (double)getTickCount();
+
+		SharpenFast( src, dst2 );
+
+		t = ((double)getTickCount() - t)/getTickFrequency();
+		cout << "Vectorized parallel function time passed in seconds: " << t << endl;
+
+		imshow( "Output", dst2 );
+		waitKey();
+
+	//*********** [stencil ]**************
+
+		// the same kernel as template parameters: zero taps are dropped, the loop is vectorized by the compiler
+		Mat dst3;
+		t = (double)getTickCount();
+
+		stencil::filter<stencil::Sharpen3x3>( src, dst3 );
+
+		t = ((double)getTickCount() - t)/getTickFrequency();
+		cout << "Compile-time stencil time passed in seconds:  " << t << endl;
+
 	//*********** [filter2D ]**************
 
 	//![kern]
@@ -93,6 +140,10 @@ int main( int argc, char* argv[])
 		t = ((double)getTickCount() - t)/getTickFrequency();
 		cout << "Built-in filter2D time passed in seconds:     " << t << endl;
 
+		// same kernel, same default border (BORDER_REFLECT_101): the results must agree
+		cout << "Max difference between SharpenFast and filter2D: " << norm(dst2, dst1, NORM_INF) << endl;
+		cout << "Max difference between stencil and filter2D:     " << norm(dst3, dst1, NORM_INF) << endl;
+
 		imshow( "Output", dst1 );
 
 		waitKey();
@@ -139,3 +190,166 @@ void Sharpen(const Mat& myImage,Mat& Result)
 	//! [borders]
 }
 //! [basic_method]
+
+//************* [fast_method] *****************
+namespace
+{
+// a pixel in the first or the last column: its left/right neighbour goes through borderInterpolate
+inline void sharpenBorderPixel(const uchar* previous, const uchar* current, const uchar* next, uchar* output,
+															 const int x, const int cols, const int nChannels, const int borderType)
+{
+		const int col = x / nChannels, c = x % nChannels;
+		const int left  = borderInterpolate(col - 1, cols, borderType) * nChannels + c;
+		const int right = borderInterpolate(col + 1, cols, borderType) * nChannels + c;
+		output[x] = saturate_cast<uchar>(5*current[x] - current[left] - current[right] - previous[x] - next[x]);
+}
+
+// One output row of 5*I(i,j) - I(i-1,j) - I(i+1,j) - I(i,j-1) - I(i,j+1).
+// prev and next are the rows above and below, already resolved for the border.
+// The first and the last pixel look up their left/right neighbour through
+// borderInterpolate; everything in between is done 16 bytes at a time.
+void sharpenRow(const uchar* previous, const uchar* current, const uchar* next, uchar* output,
+								const int cols, const int nChannels, const int borderType)
+{
+		const int width = cols * nChannels;
+
+		for (int x = 0; x < min(nChannels, width); ++x)
+				sharpenBorderPixel(previous, current, next, output, x, cols, nChannels, borderType);
+
+		// the interior: left and right neighbours are simply nChannels bytes away
+		const int end = width - nChannels;
+		int x = nChannels;
+#if defined(__SSE2__) || defined(_M_X64)
+		const __m128i zero = _mm_setzero_si128();
+		for ( ; x + 16 <= end; x += 16)
+		{
+				__m128i c = _mm_loadu_si128((const __m128i*)(current + x));
+				__m128i l = _mm_loadu_si128((const __m128i*)(current + x - nChannels));
+				__m128i r = _mm_loadu_si128((const __m128i*)(current + x + nChannels));
+				__m128i u = _mm_loadu_si128((const __m128i*)(previous + x));
+				__m128i d = _mm_loadu_si128((const __m128i*)(next + x));
+
+				// 16-bit intermediates: 5*255 and -4*255 both fit
+				__m128i cLo = _mm_unpacklo_epi8(c, zero), cHi = _mm_unpackhi_epi8(c, zero);
+				__m128i sLo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(l, zero), _mm_unpacklo_epi8(r, zero)),
+																		_mm_add_epi16(_mm_unpacklo_epi8(u, zero), _mm_unpacklo_epi8(d, zero)));
+				__m128i sHi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(l, zero), _mm_unpackhi_epi8(r, zero)),
+																		_mm_add_epi16(_mm_unpackhi_epi8(u, zero), _mm_unpackhi_epi8(d, zero)));
+				__m128i resLo = _mm_sub_epi16(_mm_add_epi16(_mm_slli_epi16(cLo, 2), cLo), sLo);
+				__m128i resHi = _mm_sub_epi16(_mm_add_epi16(_mm_slli_epi16(cHi, 2), cHi), sHi);
+
+				// saturating pack, the same as saturate_cast<uchar>
+				_mm_storeu_si128((__m128i*)(output + x), _mm_packus_epi16(resLo, resHi));
+		}
+#elif defined(__ARM_NEON)
+		for ( ; x + 16 <= end; x += 16)
+		{
+				uint8x16_t c = vld1q_u8(current + x);
+				uint8x16_t l = vld1q_u8(current + x - nChannels);
+				uint8x16_t r = vld1q_u8(current + x + nChannels);
+				uint8x16_t u = vld1q_u8(previous + x);
+				uint8x16_t d = vld1q_u8(next + x);
+
+				uint16x8_t sLo = vaddq_u16(vaddl_u8(vget_low_u8(l), vget_low_u8(r)), vaddl_u8(vget_low_u8(u), vget_low_u8(d)));
+				uint16x8_t sHi = vaddq_u16(vaddl_u8(vget_high_u8(l), vget_high_u8(r)), vaddl_u8(vget_high_u8(u), vget_high_u8(d)));
+				int16x8_t resLo = vsubq_s16(vreinterpretq_s16_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(c)), 5)), vreinterpretq_s16_u16(sLo));
+				int16x8_t resHi = vsubq_s16(vreinterpretq_s16_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(c)), 5)), vreinterpretq_s16_u16(sHi));
+
+				vst1q_u8(output + x, vcombine_u8(vqmovun_s16(resLo), vqmovun_s16(resHi)));
+		}
+#endif
+		for ( ; x < end; ++x)
+				output[x] = saturate_cast<uchar>(5*current[x] - current[x-nChannels] - current[x+nChannels] - previous[x] - next[x]);
+
+		for (int x = max(nChannels, end); x < width; ++x)
+				sharpenBorderPixel(previous, current, next, output, x, cols, nChannels, borderType);
+}
+}
+
+// Same kernel as Sharpen, but
+// - the pixels on the image border are computed too, with BORDER_REPLICATE or
+//   BORDER_REFLECT_101 (filter2D's default), instead of being set to zero afterwards
+// - 16 pixels at a time with SSE2/NEON
+// - bands of rows on all the threads; every band streams through three input rows
+//   at a time, so the rows above and below are still in cache when they are reused;
+//   images under 64 KB stay on the calling thread
+void SharpenFast(const Mat& myImage, Mat& Result, int borderType)
+{
+		CV_Assert(myImage.depth() == CV_8U);  // accept only uchar images
+		CV_Assert(borderType == BORDER_REPLICATE || borderType == BORDER_REFLECT_101);
+
+		// the rows above and below are read after they were written in place, so work on a copy
+		const Mat src = myImage.data == Result.data ? myImage.clone() : myImage;
+		const int nChannels = src.channels();
+		Result.create(src.size(), src.type());
+
+		const auto band = [&](const Range& range){
+				for (int j = range.start; j < range.end; ++j)
+				{
+						const uchar* previous = src.ptr<uchar>(borderInterpolate(j - 1, src.rows, borderType));
+						const uchar* current  = src.ptr<uchar>(j);
+						const uchar* next     = src.ptr<uchar>(borderInterpolate(j + 1, src.rows, borderType));
+						sharpenRow(previous, current, next, Result.ptr<uchar>(j), src.cols, nChannels, borderType);
+				}
+		};
+		// under 64 KB the whole image is one band: handing it to the thread pool
+		// costs more than the filter, which then loses to filter2D
+		const double bytes = (double)src.total() * src.elemSize();
+		if (bytes < (1 << 16))
+				band(Range(0, src.rows));
+		else
+				parallel_for_(Range(0, src.rows), band, bytes / (1 << 16));
+}
+//! [fast_method]
+
+//************* [convolution_sweep] *****************
+// For every kernel size: a dense (random, not separable) kernel through
+// conv::spatialFilter (filter2D while it stays spatial, then a direct loop)
+// and through the FFT, and a Gaussian of the same size through sepFilter2D.
+// The FFT time hardly depends on the kernel, so it serves both. Next to the
+// timings: what conv::choose() would have picked and what was really fastest.
+static int convolutionSweep(const Mat& src)
+{
+		bench::Options options;
+		options.warmup = 1;
+		options.iterations = 5;
+		bench::Benchmark benchmark("convolution sweep", options);
+		const double bytes = (double)src.total() * src.elemSize();
+		RNG rng(12345);
+
+		cout << src.cols << "x" << src.rows << ", " << src.channels() << " channel(s), median of "
+				<< options.iterations << " runs, ms" << endl
+				<< " kernel   spatial  separable        fft   dense: model/fastest   gaussian: model/fastest   max |fft - spatial|" << endl;
+
+		const int sizes[] = { 3, 5, 7, 9, 11, 15, 21, 31, 41, 63 };
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+		{
+				const int k = sizes[i];
+				Mat dense(k, k, CV_32F);
+				rng.fill(dense, RNG::UNIFORM, 0, 1);
+				dense /= sum(dense)[0];
+				Mat g = getGaussianKernel(k, -1, CV_32F);
+				Mat gaussian = g * g.t();
+
+				Mat spatialDst, separableDst, fftDst;
+				ostringstream name;
+				name << k << "x" << k;
+				const double spatial = benchmark.run("spatial " + name.str(), bytes,
+						[&]{ conv::filter(src, spatialDst, dense, conv::METHOD_SPATIAL); }).medianMs;
+				const double separable = benchmark.run("separable " + name.str(), bytes,
+						[&]{ conv::filter(src, separableDst, gaussian, conv::METHOD_SEPARABLE); }).medianMs;
+				const double fft = benchmark.run("fft " + name.str(), bytes,
+						[&]{ conv::filter(src, fftDst, dense, conv::METHOD_FFT); }).medianMs;
+
+				const int denseBest = fft < spatial ? conv::METHOD_FFT : conv::METHOD_SPATIAL;
+				const int gaussianBest = separable <= min(fft, spatial) ? conv::METHOD_SEPARABLE : denseBest;
+				cout << fixed << setprecision(2)
+						<< setw(7) << k << setw(10) << spatial << setw(11) << separable << setw(11) << fft
+						<< setw(14) << conv::methodName(conv::choose(src.size(), Size(k, k), false))
+						<< "/" << left << setw(10) << conv::methodName(denseBest) << right
+						<< setw(16) << conv::methodName(conv::choose(src.size(), Size(k, k), true))
+						<< "/" << left << setw(10) << conv::methodName(gaussianBest) << right
+						<< setw(20) << norm(fftDst, spatialDst, NORM_INF) << endl;
+		}
+		return EXIT_SUCCESS;
+}
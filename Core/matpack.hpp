@@ -0,0 +1,401 @@
+/**
+ * @file matpack.hpp
+ * @brief Binary container for matrices and a few scalars, read through mmap
+ *
+ *     matpack::Writer out("calib.mpk");
+ *     out.write("iterationNr", 100);
+ *     out.write("R", R);
+ *     out.write("features", descriptors);
+ *     out.release();                               // writes the key index
+ *
+ *     matpack::Reader in("calib.mpk");
+ *     Mat features = in.mat("features");          // no parse, no copy
+ *
+ * The file is a 64-byte header, the payloads (raw rows, back to back, each
+ * payload starting on a 64-byte boundary) and an index of entries sorted by
+ * key followed by the key characters. Opening a file maps it and checks the
+ * header; a lookup is a binary search in the mapped index and mat() returns
+ * a header whose data points into the mapping, so only the pages that are
+ * touched are read from disk. The mapping is private: writing to such a Mat
+ * changes the process's copy of the page, never the file.
+ *
+ * A Mat from a Reader is valid as long as the Reader is open. Files are
+ * written in the byte order of the machine; a Reader refuses the other one.
+ */
+
+#ifndef CORE_MATPACK_HPP
+#define CORE_MATPACK_HPP
+
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MATPACK_MMAP 1
+#else
+#define MATPACK_MMAP 0
+#endif
+
+namespace matpack
+{
+
+enum Kind { KIND_MAT = 1, KIND_INT = 2, KIND_REAL = 3, KIND_STRING = 4 };
+
+namespace detail
+{
+const char MAGIC[8] = { 'C', 'V', 'M', 'A', 'T', 'P', 'K', 0 };
+const unsigned VERSION = 1;
+const unsigned BYTE_ORDER_TAG = 0x01020304;
+const size_t ALIGNMENT = 64;
+
+struct Header
+{
+		char magic[8];
+		unsigned version;
+		unsigned byteOrder;
+		uint64 count;         // entries in the index
+		uint64 indexOffset;   // first entry, the key characters follow the last one
+		uint64 fileBytes;
+		char reserved[24];
+};
+
+struct Entry
+{
+		uint64 offset;        // payload, a multiple of ALIGNMENT
+		uint64 bytes;
+		unsigned keyOffset;   // from the end of the entries
+		unsigned keyBytes;
+		int kind;
+		int type;             // KIND_MAT: the Mat type, else CV_32S, CV_64F or CV_8U
+		int rows, cols;
+		uint64 reserved;
+};
+} // namespace detail
+
+class Writer
+{
+public:
+		Writer() : m_offset(0) {}
+		explicit Writer(const std::string& path) : m_offset(0) { open(path); }
+		~Writer() { release(); }
+
+		bool open(const std::string& path)
+		{
+				release();
+				m_file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+				if (!m_file)
+						return false;
+				detail::Header header = detail::Header();
+				m_file.write((const char*)&header, sizeof(header));   // rewritten by release()
+				m_offset = sizeof(header);
+				return (bool)m_file;
+		}
+
+		bool isOpened() const { return m_file.is_open(); }
+
+		// 2-D matrices of any type; the rows are stored without padding
+		void write(const std::string& key, const cv::Mat& m)
+		{
+				CV_Assert(m.dims <= 2);
+				const size_t rowBytes = m.cols * m.elemSize();
+				detail::Entry& e = add(key, KIND_MAT, m.type(), m.rows, m.cols, rowBytes * m.rows);
+				if (m.isContinuous())
+						m_file.write((const char*)m.ptr(), e.bytes);
+				else
+						for (int i = 0; i < m.rows; ++i)
+								m_file.write((const char*)m.ptr(i), rowBytes);
+				m_offset += e.bytes;
+		}
+
+		void write(const std::string& key, int value)
+		{
+				add(key, KIND_INT, CV_32S, 1, 1, sizeof(value));
+				put(&value, sizeof(value));
+		}
+
+		void write(const std::string& key, double value)
+		{
+				add(key, KIND_REAL, CV_64F, 1, 1, sizeof(value));
+				put(&value, sizeof(value));
+		}
+
+		void write(const std::string& key, const std::string& value)
+		{
+				add(key, KIND_STRING, CV_8U, 1, (int)value.size(), value.size());
+				put(value.data(), value.size());
+		}
+
+		// writes the index and the header, then closes the file
+		bool release()
+		{
+				if (!m_file.is_open())
+						return false;
+				std::sort(m_entries.begin(), m_entries.end(), ByKey(m_keys));
+				std::string pool;
+				for (size_t i = 0; i < m_entries.size(); ++i)
+				{
+						detail::Entry& e = m_entries[i];
+						const unsigned offset = (unsigned)pool.size();
+						pool.append(m_keys, e.keyOffset, e.keyBytes);
+						e.keyOffset = offset;
+				}
+
+				pad();
+				detail::Header header = detail::Header();
+				std::memcpy(header.magic, detail::MAGIC, sizeof(header.magic));
+				header.version = detail::VERSION;
+				header.byteOrder = detail::BYTE_ORDER_TAG;
+				header.count = m_entries.size();
+				header.indexOffset = m_offset;
+				if (!m_entries.empty())
+						m_file.write((const char*)&m_entries[0], m_entries.size() * sizeof(detail::Entry));
+				m_file.write(pool.data(), pool.size());
+				header.fileBytes = m_offset + m_entries.size() * sizeof(detail::Entry) + pool.size();
+				m_file.seekp(0);
+				m_file.write((const char*)&header, sizeof(header));
+
+				const bool ok = (bool)m_file;
+				m_file.close();
+				m_entries.clear();
+				m_keys.clear();
+				m_names.clear();
+				m_offset = 0;
+				return ok;
+		}
+
+private:
+		struct ByKey
+		{
+				const std::string& keys;
+				explicit ByKey(const std::string& k) : keys(k) {}
+				bool operator()(const detail::Entry& a, const detail::Entry& b) const
+				{
+						return keys.compare(a.keyOffset, a.keyBytes, keys, b.keyOffset, b.keyBytes) < 0;
+				}
+		};
+
+		Writer(const Writer&);
+		Writer& operator=(const Writer&);
+
+		// starts an entry on the next aligned offset; the caller writes the payload
+		detail::Entry& add(const std::string& key, int kind, int type, int rows, int cols, size_t bytes)
+		{
+				CV_Assert(m_file.is_open() && !key.empty());
+				if (!m_names.insert(key).second)
+						CV_Error(cv::Error::StsBadArg, "matpack::Writer: duplicate key " + key);
+				pad();
+				detail::Entry e = detail::Entry();
+				e.offset = m_offset;
+				e.bytes = bytes;
+				e.keyOffset = (unsigned)m_keys.size();
+				e.keyBytes = (unsigned)key.size();
+				e.kind = kind;
+				e.type = type;
+				e.rows = rows;
+				e.cols = cols;
+				m_keys += key;
+				m_entries.push_back(e);
+				return m_entries.back();
+		}
+
+		void put(const void* data, size_t bytes)
+		{
+				m_file.write((const char*)data, bytes);
+				m_offset += bytes;
+		}
+
+		void pad()
+		{
+				static const char zeros[detail::ALIGNMENT] = { 0 };
+				const size_t n = (detail::ALIGNMENT - m_offset % detail::ALIGNMENT) % detail::ALIGNMENT;
+				put(zeros, n);
+		}
+
+		std::ofstream m_file;
+		uint64 m_offset;
+		std::vector<detail::Entry> m_entries;
+		std::string m_keys;   // the keys, in the order they were written
+		std::set<std::string> m_names;
+};
+
+class Reader
+{
+public:
+		Reader() : m_data(0), m_bytes(0), m_mapped(false) {}
+		explicit Reader(const std::string& path) : m_data(0), m_bytes(0), m_mapped(false) { open(path); }
+		~Reader() { release(); }
+
+		// false if the file is missing or is not a matpack file of this byte order
+		bool open(const std::string& path)
+		{
+				release();
+				if (!load(path))
+						return false;
+				const detail::Header* h = header();
+				const bool valid = m_bytes >= sizeof(detail::Header)
+						&& std::memcmp(h->magic, detail::MAGIC, sizeof(h->magic)) == 0
+						&& h->version == detail::VERSION && h->byteOrder == detail::BYTE_ORDER_TAG
+						&& h->fileBytes == m_bytes && h->indexOffset % detail::ALIGNMENT == 0
+						&& h->indexOffset <= m_bytes
+						&& h->count <= (m_bytes - h->indexOffset) / sizeof(detail::Entry);
+				if (!valid)
+						release();
+				return valid;
+		}
+
+		bool isOpened() const { return m_data != 0; }
+
+		void release()
+		{
+#if MATPACK_MMAP
+				if (m_mapped)
+						munmap(m_data, m_bytes);
+				else
+#endif
+						cv::fastFree(m_data);
+				m_data = 0;
+				m_bytes = 0;
+				m_mapped = false;
+		}
+
+		size_t size() const { return isOpened() ? (size_t)header()->count : 0; }
+
+		// keys in sorted order
+		std::string key(size_t i) const
+		{
+				CV_Assert(i < size());
+				const detail::Entry& e = entries()[i];
+				return std::string(keyPool() + e.keyOffset, e.keyBytes);
+		}
+
+		bool has(const std::string& key) const { return find(key) != 0; }
+
+		// a header over the mapped payload, empty if there is no such key
+		cv::Mat mat(const std::string& key) const
+		{
+				const detail::Entry* e = find(key);
+				if (!e)
+						return cv::Mat();
+				check(*e, KIND_MAT);
+				return cv::Mat(e->rows, e->cols, e->type, m_data + e->offset);
+		}
+
+		int getInt(const std::string& key, int defaultValue = 0) const
+		{
+				const detail::Entry* e = find(key);
+				if (!e)
+						return defaultValue;
+				check(*e, KIND_INT);
+				int v;
+				std::memcpy(&v, m_data + e->offset, sizeof(v));
+				return v;
+		}
+
+		double getReal(const std::string& key, double defaultValue = 0) const
+		{
+				const detail::Entry* e = find(key);
+				if (!e)
+						return defaultValue;
+				check(*e, KIND_REAL);
+				double v;
+				std::memcpy(&v, m_data + e->offset, sizeof(v));
+				return v;
+		}
+
+		std::string getString(const std::string& key, const std::string& defaultValue = std::string()) const
+		{
+				const detail::Entry* e = find(key);
+				if (!e)
+						return defaultValue;
+				check(*e, KIND_STRING);
+				return std::string((const char*)m_data + e->offset, (size_t)e->bytes);
+		}
+
+private:
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+
+		bool load(const std::string& path)
+		{
+#if MATPACK_MMAP
+				const int fd = ::open(path.c_str(), O_RDONLY);
+				if (fd < 0)
+						return false;
+				struct stat st;
+				void* p = MAP_FAILED;
+				if (fstat(fd, &st) == 0 && st.st_size > 0)
+						p = mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+				::close(fd);   // the mapping keeps the file
+				if (p == MAP_FAILED)
+						return false;
+				m_data = (uchar*)p;
+				m_bytes = (size_t)st.st_size;
+				m_mapped = true;
+				return true;
+#else
+				// no mmap: read the whole file into an aligned buffer
+				std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+				if (!file)
+						return false;
+				m_bytes = (size_t)file.tellg();
+				m_data = (uchar*)cv::fastMalloc(std::max(m_bytes, (size_t)1));
+				file.seekg(0);
+				if (!file.read((char*)m_data, m_bytes))
+						release();
+				return m_data != 0;
+#endif
+		}
+
+		const detail::Header* header() const { return (const detail::Header*)m_data; }
+		const detail::Entry* entries() const { return (const detail::Entry*)(m_data + header()->indexOffset); }
+		const char* keyPool() const { return (const char*)(entries() + header()->count); }
+
+		const detail::Entry* find(const std::string& key) const
+		{
+				const detail::Entry* e = entries();
+				size_t lo = 0, hi = size();
+				const size_t poolBytes = m_bytes - (keyPool() - (const char*)m_data);
+				while (lo < hi)
+				{
+						const size_t mid = (lo + hi) / 2;
+						if ((uint64)e[mid].keyOffset + e[mid].keyBytes > poolBytes)
+								CV_Error(cv::Error::StsError, "matpack::Reader: corrupt key index");
+						const int c = key.compare(0, key.size(), keyPool() + e[mid].keyOffset, e[mid].keyBytes);
+						if (c == 0)
+								return &e[mid];
+						if (c < 0)
+								hi = mid;
+						else
+								lo = mid + 1;
+				}
+				return 0;
+		}
+
+		void check(const detail::Entry& e, int kind) const
+		{
+				if (e.kind != kind)
+						CV_Error(cv::Error::StsBadArg, "matpack::Reader: " + std::string(keyPool() + e.keyOffset, e.keyBytes)
+										 + " has another kind");
+				const uint64 expected = kind == KIND_STRING ? (uint64)e.cols
+						: (uint64)e.rows * e.cols * CV_ELEM_SIZE1(e.type) * CV_MAT_CN(e.type);
+				if (e.rows < 0 || e.cols < 0 || e.bytes != expected || e.offset % detail::ALIGNMENT != 0
+						|| e.offset > header()->indexOffset || e.bytes > header()->indexOffset - e.offset)
+						CV_Error(cv::Error::StsError, "matpack::Reader: corrupt entry");
+		}
+
+		uchar* m_data;
+		size_t m_bytes;
+		bool m_mapped;
+};
+
+} // namespace matpack
+
+#endif // CORE_MATPACK_HPP
@@ -9,8 +9,41 @@
 //
 
 #include <iostream>
+#include <iomanip>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MANDELBROT_HTTP 1
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#else
+#define MANDELBROT_HTTP 0
+#endif
+
+// x86 builds carry AVX2 and AVX-512 versions of the escape-time kernel next to the
+// scalar one; which one runs is decided at runtime from the CPU features
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MANDELBROT_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define MANDELBROT_X86_DISPATCH 0
+#endif
 
 using namespace std;
 using namespace cv;
@@ -34,9 +67,61 @@ int mandelbrot(const complex<float> &z0, const int max)
 }
 //! [mandelbrot-escape-time-algorithm]
 
+//! [mandelbrot-interior-checks]
+// Interior shortcuts, opt-in (the default MANDELBROT_PLAIN is the algorithm above).
+// Interior pixels never escape, so without these they always run all max iterations.
+enum MandelbrotMode
+{
+		MANDELBROT_PLAIN       = 0,
+		MANDELBROT_BULB_CHECK  = 1, // analytic test for the main cardioid and the period-2 bulb
+		MANDELBROT_PERIODICITY = 2  // Brent-style cycle detection for the other interior points
+};
+
+// The main cardioid is q*(q + (x - 1/4)) <= y^2/4 with q = (x - 1/4)^2 + y^2,
+// the period-2 bulb the disk of radius 1/4 around -1.
+bool insideCardioidOrBulb(const complex<float> &c)
+{
+		const float x = c.real(), y = c.imag();
+		const float xm = x - 0.25f;
+		const float q = xm*xm + y*y;
+		if (q*(q + xm) <= 0.25f*y*y)
+				return true;
+		const float xp = x + 1.0f;
+		return xp*xp + y*y <= 0.0625f;
+}
+
+int mandelbrot(const complex<float> &z0, const int max, const int mode)
+{
+		if ((mode & MANDELBROT_BULB_CHECK) && insideCardioidOrBulb(z0))
+				return max;
+		if (!(mode & MANDELBROT_PERIODICITY))
+				return mandelbrot(z0, max);
+
+		// Brent: remember z at steps 1, 2, 4, 8, ... and compare every new z with it.
+		// The float orbit is deterministic, so once z repeats exactly it cycles forever
+		// and, since every point of the cycle was already tested, never escapes.
+		// The result is therefore the same as with the plain loop.
+		complex<float> z = z0, saved = z0;
+		int power = 1, lambda = 0;
+		for (int t = 0; t < max; t++)
+		{
+				if (z.real()*z.real() + z.imag()*z.imag() > 4.0f) return t;
+				z = z*z + z0;
+				if (z == saved) return max;
+				if (++lambda == power)
+				{
+						saved = z;
+						power *= 2;
+						lambda = 0;
+				}
+		}
+
+		return max;
+}
+//! [mandelbrot-interior-checks]
+
 //! [mandelbrot-grayscale-value]
-int mandelbrotFormula(const complex<float> &z0, const int maxIter=500) {
-		int value = mandelbrot(z0, maxIter);
+int mandelbrotGray(const int value, const int maxIter) {
 		// if equal: not escape => in set => black
 		if(maxIter - value == 0)
 		{
@@ -45,6 +130,11 @@ int mandelbrotFormula(const complex<float> &z0, const int maxIter=500) {
 		// else escape: not in => the closer value and max are the whiter (to make the edge clean with a sqrt transformation)
 		return cvRound(sqrt(value / (float) maxIter) * 255);
 }
+
+int mandelbrotFormula(const complex<float> &z0, const int maxIter=500) {
+		int value = mandelbrot(z0, maxIter);
+		return mandelbrotGray(value, maxIter);
+}
 //! [mandelbrot-grayscale-value]
 
 //! [mandelbrot-parallel]
@@ -104,10 +194,1232 @@ void sequentialMandelbrot(Mat &img, const float x1, const float y1, const float
 		}
 }
 //! [mandelbrot-sequential]
+
+//! [mandelbrot-tiles]
+// Work-stealing tile scheduler.
+// The image is cut into small 2D tiles. Every worker starts with its own band of
+// tiles in a queue, takes tiles from the front of it and, once it runs dry, steals
+// from the back of the other queues. Tiles inside the set cost up to maxIter
+// iterations per pixel and the others only a few, so a static split leaves the
+// workers with the cheap bands idle while the others still run.
+class TileQueue
+{
+public:
+		void push(const Rect& tile)
+		{
+				lock_guard<mutex> lock(m_mutex);
+				m_tiles.push_back(tile);
+		}
+		// owner end
+		bool pop(Rect& tile)
+		{
+				lock_guard<mutex> lock(m_mutex);
+				if (m_tiles.empty()) return false;
+				tile = m_tiles.front();
+				m_tiles.pop_front();
+				return true;
+		}
+		// thief end, as far as possible from where the owner is working
+		bool steal(Rect& tile)
+		{
+				lock_guard<mutex> lock(m_mutex);
+				if (m_tiles.empty()) return false;
+				tile = m_tiles.back();
+				m_tiles.pop_back();
+				return true;
+		}
+
+private:
+		mutex m_mutex;
+		deque<Rect> m_tiles;
+};
+
+struct WorkerStats
+{
+		double busy;  // seconds spent rendering tiles
+		int tiles;    // tiles rendered
+		int stolen;   // of which taken from another worker's queue
+};
+
+// Render one tile. The row coordinate is computed once per row, and there is no
+// integer division or modulo per pixel; the values are the same as sequentialMandelbrot.
+void renderTile(Mat &img, const Rect& tile, const float x1, const float y1, const float scaleX, const float scaleY)
+{
+		for (int i = tile.y; i < tile.y + tile.height; i++)
+		{
+				const float y0 = i / scaleY + y1;
+				uchar* row = img.ptr<uchar>(i);
+				for (int j = tile.x; j < tile.x + tile.width; j++)
+				{
+						float x0 = j / scaleX + x1;
+						row[j] = (uchar) mandelbrotFormula(complex<float>(x0, y0));
+				}
+		}
+}
+
+// steal == false runs the same tiles with a static split (no stealing),
+// which shows the imbalance the scheduler removes
+vector<WorkerStats> tiledMandelbrot(Mat &img, const float x1, const float y1, const float scaleX, const float scaleY,
+																		const bool steal = true, const Size tileSize = Size(64, 64))
+{
+		const int nWorkers = max(1, getNumThreads());
+		const int tilesX = (img.cols + tileSize.width - 1) / tileSize.width;
+		const int tilesY = (img.rows + tileSize.height - 1) / tileSize.height;
+		const int nTiles = tilesX * tilesY;
+
+		// worker w starts with tiles [w*nTiles/nWorkers, (w+1)*nTiles/nWorkers) in row-major order,
+		// i.e. a horizontal band of the image like the static split of the flat range
+		vector<TileQueue> queues(nWorkers);
+		for (int w = 0; w < nWorkers; w++)
+				for (int t = w * nTiles / nWorkers; t < (w + 1) * nTiles / nWorkers; t++)
+				{
+						Rect tile((t % tilesX) * tileSize.width, (t / tilesX) * tileSize.height, tileSize.width, tileSize.height);
+						queues[w].push(tile & Rect(0, 0, img.cols, img.rows));
+				}
+
+		vector<WorkerStats> stats(nWorkers, WorkerStats());
+
+		// one stripe per worker; if the pool runs fewer stripes at a time the
+		// workers that run first simply steal the tiles of the ones still waiting
+		parallel_for_(Range(0, nWorkers), [&](const Range& range){
+				for (int w = range.start; w < range.end; w++)
+				{
+						WorkerStats& st = stats[w];
+						Rect tile;
+						for (;;)
+						{
+								bool stolen = false;
+								if (!queues[w].pop(tile))
+								{
+										if (!steal) break;
+										for (int k = 1; k < nWorkers && !stolen; k++)
+												stolen = queues[(w + k) % nWorkers].steal(tile);
+										if (!stolen) break;
+								}
+
+								int64 t = getTickCount();
+								renderTile(img, tile, x1, y1, scaleX, scaleY);
+								st.busy += (getTickCount() - t) / getTickFrequency();
+								st.tiles++;
+								st.stolen += stolen;
+						}
+				}
+		}, nWorkers);
+
+		return stats;
+}
+
+void printWorkerStats(const vector<WorkerStats>& stats)
+{
+		double total = 0, longest = 0;
+		for (size_t w = 0; w < stats.size(); w++)
+		{
+				cout << "  worker " << setw(2) << w << ": busy " << fixed << setprecision(3) << stats[w].busy
+						 << " s, " << stats[w].tiles << " tiles (" << stats[w].stolen << " stolen)" << endl;
+				total += stats[w].busy;
+				longest = max(longest, stats[w].busy);
+		}
+		cout.unsetf(ios::fixed);
+		cout << setprecision(6);
+		// 1 means every worker was busy for the same time
+		if (total > 0)
+				cout << "  imbalance (longest / mean busy time): " << longest * stats.size() / total << endl;
+}
+//! [mandelbrot-tiles]
+
+//! [mandelbrot-simd]
+// Vectorized escape time: 8 (AVX2) or 16 (AVX-512) pixels of a row iterate in lockstep.
+// Every lane keeps an "active" bit that is cleared the first time |z|^2 > 4 and
+// never set again; the iteration counter only grows in active lanes and the loop
+// stops once no lane is active. The arithmetic is the same sequence of float
+// operations as complex<float> in mandelbrot(), so the counts, and the image, are
+// bit for bit those of sequentialMandelbrot. FMA is deliberately not enabled: a
+// fused multiply-add would round differently.
+//
+// With MANDELBROT_BULB_CHECK, lanes inside the cardioid or the bulb start inactive
+// with count maxIter; with MANDELBROT_PERIODICITY the same Brent check as in the
+// scalar code retires lanes whose z repeats.
+//
+// gray[v] is mandelbrotGray(v, maxIter) for v in [0, maxIter].
+typedef void (*MandelbrotRowFunc)(uchar* row, int cols, float y0, float x1, float scaleX,
+																	const uchar* gray, int maxIter, int mode);
+
+void mandelbrotRowScalar(uchar* row, const int cols, const float y0, const float x1, const float scaleX,
+												 const uchar* gray, const int maxIter, const int mode)
+{
+		for (int j = 0; j < cols; j++)
+		{
+				float x0 = j / scaleX + x1;
+				row[j] = gray[mandelbrot(complex<float>(x0, y0), maxIter, mode)];
+		}
+}
+
+#if MANDELBROT_X86_DISPATCH
+__attribute__((target("avx2")))
+void mandelbrotRowAVX2(uchar* row, const int cols, const float y0, const float x1, const float scaleX,
+											 const uchar* gray, const int maxIter, const int mode)
+{
+		const __m256 vScaleX = _mm256_set1_ps(scaleX), vx1 = _mm256_set1_ps(x1);
+		const __m256 ci = _mm256_set1_ps(y0), four = _mm256_set1_ps(4.0f);
+		const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i vMax = _mm256_set1_epi32(maxIter);
+		int j = 0;
+		for ( ; j + 8 <= cols; j += 8)
+		{
+				__m256 cr = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(j), lane));
+				cr = _mm256_add_ps(_mm256_div_ps(cr, vScaleX), vx1);
+				__m256 zr = cr, zi = ci;
+				__m256 active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				__m256i count = _mm256_setzero_si256();
+				if (mode & MANDELBROT_BULB_CHECK)
+				{
+						const __m256 quarter = _mm256_set1_ps(0.25f), ci2 = _mm256_mul_ps(ci, ci);
+						__m256 xm = _mm256_sub_ps(cr, quarter);
+						__m256 q = _mm256_add_ps(_mm256_mul_ps(xm, xm), ci2);
+						__m256 interior = _mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, xm)), _mm256_mul_ps(quarter, ci2), _CMP_LE_OQ);
+						__m256 xp = _mm256_add_ps(cr, _mm256_set1_ps(1.0f));
+						interior = _mm256_or_ps(interior, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(xp, xp), ci2), _mm256_set1_ps(0.0625f), _CMP_LE_OQ));
+						count = _mm256_and_si256(_mm256_castps_si256(interior), vMax);
+						active = _mm256_andnot_ps(interior, active);
+				}
+				__m256 savedR = zr, savedI = zi;
+				int power = 1, lambda = 0;
+				for (int t = 0; t < maxIter; t++)
+				{
+						__m256 zr2 = _mm256_mul_ps(zr, zr), zi2 = _mm256_mul_ps(zi, zi);
+						// !(|z|^2 > 4), true for NaN like the scalar test
+						active = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_add_ps(zr2, zi2), four, _CMP_NGT_UQ));
+						if (_mm256_movemask_ps(active) == 0) break;
+						count = _mm256_sub_epi32(count, _mm256_castps_si256(active)); // active lanes are -1
+						// escaped lanes keep iterating, but their mask bit is already gone
+						__m256 zrzi = _mm256_mul_ps(zr, zi);
+						zr = _mm256_add_ps(_mm256_sub_ps(zr2, zi2), cr);
+						zi = _mm256_add_ps(_mm256_add_ps(zrzi, zrzi), ci);
+						if (mode & MANDELBROT_PERIODICITY)
+						{
+								__m256 cycle = _mm256_and_ps(active, _mm256_and_ps(_mm256_cmp_ps(zr, savedR, _CMP_EQ_OQ),
+																																	 _mm256_cmp_ps(zi, savedI, _CMP_EQ_OQ)));
+								count = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(count), _mm256_castsi256_ps(vMax), cycle));
+								active = _mm256_andnot_ps(cycle, active);
+								if (++lambda == power)
+								{
+										savedR = zr;
+										savedI = zi;
+										power *= 2;
+										lambda = 0;
+								}
+						}
+				}
+				int counts[8];
+				_mm256_storeu_si256((__m256i*)counts, count);
+				for (int k = 0; k < 8; k++)
+						row[j + k] = gray[counts[k]];
+		}
+		for ( ; j < cols; j++)
+		{
+				float x0 = j / scaleX + x1;
+				row[j] = gray[mandelbrot(complex<float>(x0, y0), maxIter, mode)];
+		}
+}
+
+__attribute__((target("avx512f")))
+void mandelbrotRowAVX512(uchar* row, const int cols, const float y0, const float x1, const float scaleX,
+												 const uchar* gray, const int maxIter, const int mode)
+{
+		const __m512 vScaleX = _mm512_set1_ps(scaleX), vx1 = _mm512_set1_ps(x1);
+		const __m512 ci = _mm512_set1_ps(y0), four = _mm512_set1_ps(4.0f);
+		const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m512i one = _mm512_set1_epi32(1);
+		const __m512i vMax = _mm512_set1_epi32(maxIter);
+		int j = 0;
+		for ( ; j + 16 <= cols; j += 16)
+		{
+				__m512 cr = _mm512_cvtepi32_ps(_mm512_add_epi32(_mm512_set1_epi32(j), lane));
+				cr = _mm512_add_ps(_mm512_div_ps(cr, vScaleX), vx1);
+				__m512 zr = cr, zi = ci;
+				__mmask16 active = 0xFFFF;
+				__m512i count = _mm512_setzero_si512();
+				if (mode & MANDELBROT_BULB_CHECK)
+				{
+						const __m512 quarter = _mm512_set1_ps(0.25f), ci2 = _mm512_mul_ps(ci, ci);
+						__m512 xm = _mm512_sub_ps(cr, quarter);
+						__m512 q = _mm512_add_ps(_mm512_mul_ps(xm, xm), ci2);
+						__mmask16 interior = _mm512_cmp_ps_mask(_mm512_mul_ps(q, _mm512_add_ps(q, xm)), _mm512_mul_ps(quarter, ci2), _CMP_LE_OQ);
+						__m512 xp = _mm512_add_ps(cr, _mm512_set1_ps(1.0f));
+						interior |= _mm512_cmp_ps_mask(_mm512_add_ps(_mm512_mul_ps(xp, xp), ci2), _mm512_set1_ps(0.0625f), _CMP_LE_OQ);
+						count = _mm512_mask_mov_epi32(count, interior, vMax);
+						active &= ~interior;
+				}
+				__m512 savedR = zr, savedI = zi;
+				int power = 1, lambda = 0;
+				for (int t = 0; t < maxIter; t++)
+				{
+						__m512 zr2 = _mm512_mul_ps(zr, zr), zi2 = _mm512_mul_ps(zi, zi);
+						active &= _mm512_cmp_ps_mask(_mm512_add_ps(zr2, zi2), four, _CMP_NGT_UQ);
+						if (!active) break;
+						count = _mm512_mask_add_epi32(count, active, count, one);
+						__m512 zrzi = _mm512_mul_ps(zr, zi);
+						zr = _mm512_add_ps(_mm512_sub_ps(zr2, zi2), cr);
+						zi = _mm512_add_ps(_mm512_add_ps(zrzi, zrzi), ci);
+						if (mode & MANDELBROT_PERIODICITY)
+						{
+								__mmask16 cycle = active & _mm512_cmp_ps_mask(zr, savedR, _CMP_EQ_OQ)
+																				 & _mm512_cmp_ps_mask(zi, savedI, _CMP_EQ_OQ);
+								count = _mm512_mask_mov_epi32(count, cycle, vMax);
+								active &= ~cycle;
+								if (++lambda == power)
+								{
+										savedR = zr;
+										savedI = zi;
+										power *= 2;
+										lambda = 0;
+								}
+						}
+				}
+				int counts[16];
+				_mm512_storeu_si512((void*)counts, count);
+				for (int k = 0; k < 16; k++)
+						row[j + k] = gray[counts[k]];
+		}
+		for ( ; j < cols; j++)
+		{
+				float x0 = j / scaleX + x1;
+				row[j] = gray[mandelbrot(complex<float>(x0, y0), maxIter, mode)];
+		}
+}
+#endif
+
+// CPU feature dispatch, widest first
+MandelbrotRowFunc selectMandelbrotRow(const char** name)
+{
+#if MANDELBROT_X86_DISPATCH
+		if (checkHardwareSupport(CV_CPU_AVX_512F))
+		{
+				*name = "AVX-512";
+				return mandelbrotRowAVX512;
+		}
+		if (checkHardwareSupport(CV_CPU_AVX2))
+		{
+				*name = "AVX2";
+				return mandelbrotRowAVX2;
+		}
+#endif
+		*name = "scalar";
+		return mandelbrotRowScalar;
+}
+
+void simdMandelbrot(Mat &img, const float x1, const float y1, const float scaleX, const float scaleY,
+										const int maxIter = 500, const int mode = MANDELBROT_PLAIN)
+{
+		vector<uchar> gray(maxIter + 1);
+		for (int v = 0; v <= maxIter; v++)
+				gray[v] = (uchar) mandelbrotGray(v, maxIter);
+
+		const char* name;
+		const MandelbrotRowFunc mandelbrotRow = selectMandelbrotRow(&name);
+
+		parallel_for_(Range(0, img.rows), [&](const Range& range){
+				for (int i = range.start; i < range.end; i++)
+						mandelbrotRow(img.ptr<uchar>(i), img.cols, i / scaleY + y1, x1, scaleX, &gray[0], maxIter, mode);
+		});
+}
+//! [mandelbrot-simd]
+
+//! [mandelbrot-precision-ladder]
+// Precision ladder for deep zooms.
+// complex<float> has a 24-bit mantissa: once neighbouring pixels are closer than
+// about 2^-20 the coordinates collapse and the image turns into blocks. The ladder
+// picks the cheapest arithmetic that still resolves the pixel size:
+//   float           SIMD kernel above
+//   double          53 bits
+//   double-double   about 106 bits, from pairs of doubles (per pixel, slow)
+//   perturbation    one reference orbit in arbitrary precision (BigFixed), every
+//                   pixel iterates only its small difference to it in double,
+//                   and a series approximation skips the first iterations
+enum MandelbrotPrecision
+{
+		PRECISION_AUTO = -1,
+		PRECISION_FLOAT,
+		PRECISION_DOUBLE,
+		PRECISION_DOUBLE_DOUBLE,
+		PRECISION_PERTURBATION
+};
+
+const char* precisionName(const MandelbrotPrecision precision)
+{
+		switch (precision)
+		{
+		case PRECISION_FLOAT:         return "float";
+		case PRECISION_DOUBLE:        return "double";
+		case PRECISION_DOUBLE_DOUBLE: return "double-double";
+		case PRECISION_PERTURBATION:  return "perturbation";
+		default:                      return "auto";
+		}
+}
+
+// Signed fixed point number with a 32-bit integer part and (limbs - 1) 32-bit
+// fractional limbs: value = +-(limb[0] + limb[1]*2^-32 + limb[2]*2^-64 + ...).
+// Only what the reference orbit needs: +, -, * and conversions.
+class BigFixed
+{
+public:
+		explicit BigFixed(const int limbs = 4) : m_neg(false), m_limbs(max(2, limbs), 0u)
+		{}
+
+		static BigFixed fromDouble(double v, const int limbs)
+		{
+				BigFixed r(limbs);
+				r.m_neg = v < 0;
+				v = fabs(v);
+				CV_Assert(v < 4294967296.0);
+				for (size_t k = 0; k < r.m_limbs.size() && v > 0; k++)
+				{
+						double limb = floor(v);
+						r.m_limbs[k] = (uint32_t) limb;
+						v = (v - limb) * 4294967296.0;
+				}
+				r.normalizeZero();
+				return r;
+		}
+
+		// decimal string such as "-0.743643887037158704752191506114774"
+		static bool parse(const string& text, const int limbs, BigFixed& out)
+		{
+				BigFixed r(limbs);
+				size_t pos = 0;
+				if (pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+						r.m_neg = text[pos++] == '-';
+				uint64_t integer = 0;
+				size_t start = pos;
+				while (pos < text.size() && isdigit((unsigned char) text[pos]))
+				{
+						integer = integer * 10 + (text[pos++] - '0');
+						if (integer >= 4294967296ull) return false;
+				}
+				string fraction;
+				if (pos < text.size() && text[pos] == '.')
+						for (pos++; pos < text.size() && isdigit((unsigned char) text[pos]); pos++)
+								fraction += text[pos];
+				if (pos != text.size() || (pos == start))
+						return false;
+
+				// fraction = 0.d1 d2 ... dn: from the last digit, f = (f + d) / 10
+				for (size_t k = fraction.size(); k-- > 0; )
+				{
+						r.m_limbs[0] = fraction[k] - '0';
+						uint64_t rem = 0;
+						for (size_t i = 0; i < r.m_limbs.size(); i++)
+						{
+								uint64_t cur = (rem << 32) | r.m_limbs[i];
+								r.m_limbs[i] = (uint32_t) (cur / 10);
+								rem = cur % 10;
+						}
+				}
+				r.m_limbs[0] = (uint32_t) integer;
+				r.normalizeZero();
+				out = r;
+				return true;
+		}
+
+		double toDouble() const
+		{
+				double v = 0, w = 1;
+				for (size_t k = 0; k < m_limbs.size() && k < 4; k++, w /= 4294967296.0)
+						v += m_limbs[k] * w;
+				return m_neg ? -v : v;
+		}
+
+		int limbs() const { return (int) m_limbs.size(); }
+
+		// same value with more (or fewer, truncating) fractional limbs
+		BigFixed resized(const int limbs) const
+		{
+				BigFixed r(*this);
+				r.m_limbs.resize(max(2, limbs), 0u);
+				r.normalizeZero();
+				return r;
+		}
+
+		BigFixed operator-() const
+		{
+				BigFixed r(*this);
+				r.m_neg = !r.m_neg;
+				r.normalizeZero();
+				return r;
+		}
+
+		BigFixed operator+(const BigFixed& b) const
+		{
+				CV_Assert(m_limbs.size() == b.m_limbs.size());
+				BigFixed r(limbs());
+				if (m_neg == b.m_neg)
+				{
+						addMagnitude(m_limbs, b.m_limbs, r.m_limbs);
+						r.m_neg = m_neg;
+				}
+				else if (compareMagnitude(m_limbs, b.m_limbs) >= 0)
+				{
+						subMagnitude(m_limbs, b.m_limbs, r.m_limbs);
+						r.m_neg = m_neg;
+				}
+				else
+				{
+						subMagnitude(b.m_limbs, m_limbs, r.m_limbs);
+						r.m_neg = b.m_neg;
+				}
+				r.normalizeZero();
+				return r;
+		}
+
+		BigFixed operator-(const BigFixed& b) const
+		{
+				return *this + (-b);
+		}
+
+		// schoolbook product, truncated to the same number of fractional limbs
+		BigFixed operator*(const BigFixed& b) const
+		{
+				CV_Assert(m_limbs.size() == b.m_limbs.size());
+				const size_t n = m_limbs.size();
+				vector<uint32_t> p(2 * n, 0u);  // little endian, weight 2^(32*(m - 2(n-1)))
+				for (size_t i = 0; i < n; i++)
+				{
+						const uint64_t ai = m_limbs[n - 1 - i];
+						uint64_t carry = 0;
+						for (size_t j = 0; j < n; j++)
+						{
+								uint64_t t = ai * b.m_limbs[n - 1 - j] + p[i + j] + carry;
+								p[i + j] = (uint32_t) t;
+								carry = t >> 32;
+						}
+						p[i + n] = (uint32_t) carry;
+				}
+				BigFixed r((int) n);
+				for (size_t k = 0; k < n; k++)
+						r.m_limbs[k] = p[2 * n - 2 - k];
+				r.m_neg = m_neg != b.m_neg;
+				r.normalizeZero();
+				return r;
+		}
+
+private:
+		static int compareMagnitude(const vector<uint32_t>& a, const vector<uint32_t>& b)
+		{
+				for (size_t k = 0; k < a.size(); k++)
+						if (a[k] != b[k])
+								return a[k] < b[k] ? -1 : 1;
+				return 0;
+		}
+		static void addMagnitude(const vector<uint32_t>& a, const vector<uint32_t>& b, vector<uint32_t>& r)
+		{
+				uint64_t carry = 0;
+				for (size_t k = a.size(); k-- > 0; )
+				{
+						uint64_t t = (uint64_t) a[k] + b[k] + carry;
+						r[k] = (uint32_t) t;
+						carry = t >> 32;
+				}
+		}
+		// |a| >= |b|
+		static void subMagnitude(const vector<uint32_t>& a, const vector<uint32_t>& b, vector<uint32_t>& r)
+		{
+				int64_t borrow = 0;
+				for (size_t k = a.size(); k-- > 0; )
+				{
+						int64_t t = (int64_t) a[k] - b[k] - borrow;
+						borrow = t < 0;
+						r[k] = (uint32_t) (t + (borrow << 32));
+				}
+		}
+		void normalizeZero()
+		{
+				bool zero = true;
+				for (size_t k = 0; k < m_limbs.size() && zero; k++)
+						zero = m_limbs[k] == 0;
+				if (zero) m_neg = false;
+		}
+
+		bool m_neg;
+		vector<uint32_t> m_limbs;
+};
+
+// double-double: the unevaluated sum hi + lo of two doubles
+struct DoubleDouble
+{
+		double hi, lo;
+
+		DoubleDouble(const double h = 0, const double l = 0) : hi(h), lo(l)
+		{}
+};
+
+inline DoubleDouble quickTwoSum(const double a, const double b)
+{
+		double s = a + b;
+		return DoubleDouble(s, b - (s - a));
+}
+
+inline DoubleDouble twoSum(const double a, const double b)
+{
+		double s = a + b;
+		double bb = s - a;
+		return DoubleDouble(s, (a - (s - bb)) + (b - bb));
+}
+
+// exact product a*b = p + e (Dekker's split when there is no fast fma)
+inline DoubleDouble twoProd(const double a, const double b)
+{
+		double p = a * b;
+#ifdef FP_FAST_FMA
+		return DoubleDouble(p, fma(a, b, -p));
+#else
+		const double split = 134217729.0; // 2^27 + 1
+		double ta = split * a, tb = split * b;
+		double ah = ta - (ta - a), al = a - ah;
+		double bh = tb - (tb - b), bl = b - bh;
+		return DoubleDouble(p, ((ah * bh - p) + ah * bl + al * bh) + al * bl);
+#endif
 }
 
-int main()
+inline DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b)
 {
+		DoubleDouble s = twoSum(a.hi, b.hi);
+		return quickTwoSum(s.hi, s.lo + a.lo + b.lo);
+}
+
+inline DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b)
+{
+		return a + DoubleDouble(-b.hi, -b.lo);
+}
+
+inline DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b)
+{
+		DoubleDouble p = twoProd(a.hi, b.hi);
+		return quickTwoSum(p.hi, p.lo + a.hi * b.lo + a.lo * b.hi);
+}
+
+inline double toDouble(const double v) { return v; }
+inline double toDouble(const DoubleDouble& v) { return v.hi; }
+
+DoubleDouble toDoubleDouble(const BigFixed& v)
+{
+		double hi = v.toDouble();
+		BigFixed rest = v - BigFixed::fromDouble(hi, v.limbs());
+		return quickTwoSum(hi, rest.toDouble());
+}
+
+// same escape time loop as mandelbrot(), for double and DoubleDouble
+template<typename T>
+int escapeTime(const T& cx, const T& cy, const int max)
+{
+		T x = cx, y = cy;
+		for (int t = 0; t < max; t++)
+		{
+				double xh = toDouble(x), yh = toDouble(y);
+				if (xh*xh + yh*yh > 4.0) return t;
+				T xy = x*y;
+				x = x*x - y*y + cx;
+				y = xy + xy + cy;
+		}
+		return max;
+}
+
+// Bits needed to tell neighbouring pixels apart around |c| <= magnitude, plus
+// guard bits for the rounding errors the iteration amplifies.
+MandelbrotPrecision chooseMandelbrotPrecision(const double pixelSize, const double magnitude)
+{
+		const double guardBits = 8;
+		const double bits = log2(max(magnitude, 2.0) / pixelSize) + guardBits;
+		if (bits <= 24) return PRECISION_FLOAT;
+		if (bits <= 53) return PRECISION_DOUBLE;
+		// the double-double rounding errors add up over long orbits: at 20000 iterations
+		// it drifts away from the perturbation result once fewer than ~32 of its 106 bits
+		// are left over, so it is only used while that reserve is there
+		if (bits + 32 <= 106) return PRECISION_DOUBLE_DOUBLE;
+		return PRECISION_PERTURBATION;
+}
+
+// The reference orbit Z_n of one point C, rounded to double after every step
+// computed in BigFixed. Stored up to and including the first escaped value.
+void referenceOrbit(const BigFixed& cx, const BigFixed& cy, const int maxIter,
+										vector<double>& zr, vector<double>& zi)
+{
+		zr.clear(); zi.clear();
+		BigFixed x = cx, y = cy;
+		for (int n = 0; n <= maxIter; n++)
+		{
+				double xd = x.toDouble(), yd = y.toDouble();
+				zr.push_back(xd);
+				zi.push_back(yd);
+				if (xd*xd + yd*yd > 4.0) break;
+				BigFixed xy = x * y;
+				x = x*x - y*y + cx;
+				y = xy + xy + cy;
+		}
+}
+
+// Series approximation: for every pixel delta_n ~ A_n*dc + B_n*dc^2 + C_n*dc^3.
+// Returns the first iteration that still has to be computed per pixel, and its
+// coefficients. Stops as soon as the cubic term could move a pixel by more than
+// 1e-6 of its spacing, or a pixel could be about to escape.
+int seriesSkip(const vector<double>& zr, const vector<double>& zi, const double maxDelta, const double pixelSize,
+							 complex<double>& A, complex<double>& B, complex<double>& C)
+{
+		A = complex<double>(1, 0); B = C = complex<double>(0, 0);
+		const double d = maxDelta;
+		const int n = (int) zr.size() - 1;
+		int skip = 0;
+		for (int k = 0; k < n; k++)
+		{
+				const complex<double> Z2(2 * zr[k], 2 * zi[k]);
+				const complex<double> a = Z2 * A + 1.0;
+				const complex<double> b = Z2 * B + A * A;
+				const complex<double> c = Z2 * C + 2.0 * A * B;
+				const double an = abs(a), bn = abs(b), cn = abs(c);
+				if (!(cn * d * d * d < 1e-6 * pixelSize * an))
+						break;
+				if (abs(complex<double>(zr[k + 1], zi[k + 1])) + an * d + bn * d * d + cn * d * d * d >= 2.0)
+						break;
+				A = a; B = b; C = c;
+				skip = k + 1;
+		}
+		return skip;
+}
+
+// Escape time of C + dc from the reference orbit, starting at iteration n0 with delta d.
+// Returns -1 for a glitch: the pixel outlived the reference orbit, or |Z + delta|
+// became tiny compared to |Z| so the delta lost its precision.
+int perturbedEscapeTime(const vector<double>& zr, const vector<double>& zi, const int n0,
+												double dr, double di, const double dcr, const double dci, const int maxIter)
+{
+		const int nRef = (int) zr.size();
+		for (int n = n0; n < maxIter; n++)
+		{
+				if (n >= nRef) return -1;
+				const double x = zr[n] + dr, y = zi[n] + di;
+				const double mag = x*x + y*y;
+				if (mag > 4.0) return n;
+				if (mag < 1e-6 * (zr[n]*zr[n] + zi[n]*zi[n])) return -1;
+				// delta' = (2Z + delta) * delta + dc
+				const double tr = 2 * zr[n] + dr, ti = 2 * zi[n] + di;
+				const double nr = tr*dr - ti*di + dcr;
+				di = tr*di + ti*dr + dci;
+				dr = nr;
+		}
+		return maxIter;
+}
+
+// Render img centered on (cx, cy), pixel (i, j) at c = center + ((j - cols/2), (i - rows/2)) * pixelSize.
+// Returns the precision that was used.
+MandelbrotPrecision renderMandelbrotView(Mat &img, const BigFixed& cx, const BigFixed& cy, const double pixelSize,
+																				 const int maxIter, MandelbrotPrecision precision = PRECISION_AUTO)
+{
+		CV_Assert(img.type() == CV_8U && pixelSize > 0);
+		CV_Assert(pixelSize > 1e-290);   // the deltas are plain doubles
+		const double halfW = img.cols / 2.0 * pixelSize, halfH = img.rows / 2.0 * pixelSize;
+		if (precision == PRECISION_AUTO)
+				precision = chooseMandelbrotPrecision(pixelSize, max(fabs(cx.toDouble()), fabs(cy.toDouble())) + max(halfW, halfH));
+
+		vector<uchar> gray(maxIter + 1);
+		for (int v = 0; v <= maxIter; v++)
+				gray[v] = (uchar) mandelbrotGray(v, maxIter);
+
+		const int ic = img.rows / 2, jc = img.cols / 2;
+		switch (precision)
+		{
+		case PRECISION_FLOAT:
+		{
+				const double x1 = cx.toDouble() - jc * pixelSize, y1 = cy.toDouble() - ic * pixelSize;
+				simdMandelbrot(img, (float) x1, (float) y1, (float) (1 / pixelSize), (float) (1 / pixelSize),
+											 maxIter, MANDELBROT_BULB_CHECK | MANDELBROT_PERIODICITY);
+				break;
+		}
+		case PRECISION_DOUBLE:
+		{
+				const double x0 = cx.toDouble(), y0 = cy.toDouble();
+				parallel_for_(Range(0, img.rows), [&](const Range& range){
+						for (int i = range.start; i < range.end; i++)
+						{
+								const double y = y0 + (i - ic) * pixelSize;
+								uchar* row = img.ptr<uchar>(i);
+								for (int j = 0; j < img.cols; j++)
+										row[j] = gray[escapeTime(x0 + (j - jc) * pixelSize, y, maxIter)];
+						}
+				});
+				break;
+		}
+		case PRECISION_DOUBLE_DOUBLE:
+		{
+				const DoubleDouble x0 = toDoubleDouble(cx), y0 = toDoubleDouble(cy);
+				parallel_for_(Range(0, img.rows), [&](const Range& range){
+						for (int i = range.start; i < range.end; i++)
+						{
+								const DoubleDouble y = y0 + twoProd(i - ic, pixelSize);
+								uchar* row = img.ptr<uchar>(i);
+								for (int j = 0; j < img.cols; j++)
+										row[j] = gray[escapeTime(x0 + twoProd(j - jc, pixelSize), y, maxIter)];
+						}
+				});
+				break;
+		}
+		default:
+		{
+				// enough fractional limbs for the pixel size plus 64 guard bits
+				const int limbs = max(cx.limbs(), 3 + (int) ceil(-log2(pixelSize) / 32));
+				const BigFixed refX = cx.resized(limbs), refY = cy.resized(limbs);
+
+				Mat counts(img.size(), CV_32S);
+				vector<double> zr, zi;
+				referenceOrbit(refX, refY, maxIter, zr, zi);
+
+				complex<double> A, B, C;
+				const double maxDelta = sqrt(halfW * halfW + halfH * halfH);
+				const int n0 = seriesSkip(zr, zi, maxDelta, pixelSize, A, B, C);
+
+				parallel_for_(Range(0, img.rows), [&](const Range& range){
+						for (int i = range.start; i < range.end; i++)
+						{
+								int* row = counts.ptr<int>(i);
+								for (int j = 0; j < img.cols; j++)
+								{
+										const complex<double> dc((j - jc) * pixelSize, (i - ic) * pixelSize);
+										const complex<double> d = n0 > 0 ? ((C * dc + B) * dc + A) * dc : dc;
+										row[j] = perturbedEscapeTime(zr, zi, n0, d.real(), d.imag(), dc.real(), dc.imag(), maxIter);
+								}
+						}
+				});
+
+				// Glitched pixels are computed again against a new reference placed on one
+				// of them (no series skip). A few rounds remove nearly all of them; the
+				// reference pixel itself never glitches, so every round makes progress.
+				// Whatever is left after the last round is drawn as inside the set.
+				for (int round = 0; round < 16; round++)
+				{
+						vector<Point> glitched;
+						for (int i = 0; i < img.rows; i++)
+								for (int j = 0; j < img.cols; j++)
+										if (counts.ptr<int>(i)[j] < 0)
+												glitched.push_back(Point(j, i));
+						if (glitched.empty())
+								break;
+
+						const Point p = glitched[glitched.size() / 2];
+						const double offX = (p.x - jc) * pixelSize, offY = (p.y - ic) * pixelSize;
+						referenceOrbit(refX + BigFixed::fromDouble(offX, limbs), refY + BigFixed::fromDouble(offY, limbs), maxIter, zr, zi);
+						parallel_for_(Range(0, (int) glitched.size()), [&](const Range& range){
+								for (int k = range.start; k < range.end; k++)
+								{
+										const Point q = glitched[k];
+										const double dcr = (q.x - p.x) * pixelSize, dci = (q.y - p.y) * pixelSize;
+										int& count = counts.ptr<int>(q.y)[q.x];
+										count = perturbedEscapeTime(zr, zi, 0, dcr, dci, dcr, dci, maxIter);
+								}
+						});
+				}
+
+				for (int i = 0; i < img.rows; i++)
+				{
+						const int* c = counts.ptr<int>(i);
+						uchar* row = img.ptr<uchar>(i);
+						for (int j = 0; j < img.cols; j++)
+								row[j] = gray[c[j] < 0 ? maxIter : c[j]];
+				}
+				break;
+		}
+		}
+		return precision;
+}
+//! [mandelbrot-precision-ladder]
+
+//! [mandelbrot-tile-server]
+// Zoomable tile pyramid.
+// Zoom level z cuts the square (-2.25, -1.5) .. (0.75, 1.5) of the complex plane
+// into 2^z x 2^z tiles of 256x256 pixels; tile (x, y) is the x-th from the left and
+// the y-th from the top. A tile is fully determined by (z, x, y), so it is rendered
+// once and then served from memory (LRU) or from disk.
+const int TILE_SIZE = 256;
+const int TILE_MAX_ZOOM = 30;
+const double TILE_WORLD_X = -2.25;
+const double TILE_WORLD_Y = -1.5;
+const double TILE_WORLD_SIZE = 3.0;
+
+struct TileKey
+{
+		int z, x, y;
+
+		bool operator<(const TileKey& other) const
+		{
+				if (z != other.z) return z < other.z;
+				if (y != other.y) return y < other.y;
+				return x < other.x;
+		}
+		bool valid() const
+		{
+				return z >= 0 && z <= TILE_MAX_ZOOM && x >= 0 && y >= 0 && x < (1 << z) && y < (1 << z);
+		}
+		string name() const
+		{
+				ostringstream s;
+				s << z << "_" << x << "_" << y;
+				return s.str();
+		}
+};
+
+// deeper zooms show finer structure close to the set and need more iterations
+int tileMaxIter(const int z)
+{
+		return 500 + 250 * z;
+}
+
+// render the tile at tile/step resolution (step 1 is the full tile); the
+// precision ladder switches from float to double once the zoom needs it
+Mat renderTileImage(const TileKey& key, const int step = 1)
+{
+		const double span = TILE_WORLD_SIZE / (1 << key.z);
+		const int size = TILE_SIZE / step;
+		Mat img(size, size, CV_8U);
+		// the tile corners are dyadic, so these doubles are exact
+		const BigFixed cx = BigFixed::fromDouble(TILE_WORLD_X + (key.x + 0.5) * span, 4);
+		const BigFixed cy = BigFixed::fromDouble(TILE_WORLD_Y + (key.y + 0.5) * span, 4);
+		renderMandelbrotView(img, cx, cy, span / size, tileMaxIter(key.z));
+		return img;
+}
+
+class TileServer
+{
+public:
+		enum Source { FROM_MEMORY, FROM_DISK, RENDERED };
+
+		// capacity: tiles kept in memory (64 KB each); cacheDir: "" disables the disk cache
+		explicit TileServer(const size_t capacity = 1024, const string& cacheDir = string())
+				: m_capacity(max<size_t>(1, capacity)), m_cacheDir(cacheDir)
+		{
+		}
+
+		// Progressive access: onUpdate(tile, final) is called with a quick 1/4 resolution
+		// preview (upscaled to 256x256, final == false) and then with the full tile.
+		// A cached tile is delivered once, directly as final.
+		template<typename Callback>
+		Source get(const TileKey& key, Callback onUpdate)
+		{
+				CV_Assert(key.valid());
+
+				Mat tile;
+				if (lookup(key, tile))
+				{
+						onUpdate(tile, true);
+						return FROM_MEMORY;
+				}
+				if (!m_cacheDir.empty())
+				{
+						tile = imread(diskPath(key), IMREAD_GRAYSCALE);
+						if (tile.size() == Size(TILE_SIZE, TILE_SIZE))
+						{
+								insert(key, tile);
+								onUpdate(tile, true);
+								return FROM_DISK;
+						}
+				}
+
+				onUpdate(preview(key), false);
+
+				tile = renderTileImage(key);
+				insert(key, tile);
+				if (!m_cacheDir.empty())
+						imwrite(diskPath(key), tile);
+				onUpdate(tile, true);
+				return RENDERED;
+		}
+
+		Mat get(const TileKey& key, Source* source = 0)
+		{
+				Mat tile;
+				Source s = get(key, [&](const Mat& t, bool final){ if (final) tile = t; });
+				if (source) *source = s;
+				return tile;
+		}
+
+		// the coarse pass only, never cached: 16 times fewer pixels than the tile
+		Mat preview(const TileKey& key) const
+		{
+				Mat coarse = renderTileImage(key, 4), tile;
+				resize(coarse, tile, Size(TILE_SIZE, TILE_SIZE), 0, 0, INTER_NEAREST);
+				return tile;
+		}
+
+		size_t size() const
+		{
+				lock_guard<mutex> lock(m_mutex);
+				return m_lru.size();
+		}
+
+private:
+		typedef list< pair<TileKey, Mat> > LruList;
+
+		bool lookup(const TileKey& key, Mat& tile)
+		{
+				lock_guard<mutex> lock(m_mutex);
+				map<TileKey, LruList::iterator>::iterator it = m_index.find(key);
+				if (it == m_index.end())
+						return false;
+				// most recently used at the front
+				m_lru.splice(m_lru.begin(), m_lru, it->second);
+				tile = it->second->second;
+				return true;
+		}
+
+		void insert(const TileKey& key, const Mat& tile)
+		{
+				lock_guard<mutex> lock(m_mutex);
+				if (m_index.count(key))
+						return;
+				m_lru.push_front(make_pair(key, tile));
+				m_index[key] = m_lru.begin();
+				if (m_lru.size() > m_capacity)
+				{
+						m_index.erase(m_lru.back().first);
+						m_lru.pop_back();
+				}
+		}
+
+		string diskPath(const TileKey& key) const
+		{
+				return m_cacheDir + "/mandelbrot_" + key.name() + ".png";
+		}
+
+		size_t m_capacity;
+		string m_cacheDir;
+		mutable mutex m_mutex;
+		LruList m_lru;
+		map<TileKey, LruList::iterator> m_index;
+};
+
+const char* sourceName(const TileServer::Source source)
+{
+		switch (source)
+		{
+		case TileServer::FROM_MEMORY: return "memory cache";
+		case TileServer::FROM_DISK:   return "disk cache";
+		default:                      return "rendered";
+		}
+}
+
+// ./parallel tile <z> <x> <y> [<z> <x> <y> ...]
+// Serves the tiles in order through one TileServer, so repeated or revisited
+// tiles (panning back and forth) come from the cache, and writes tile_z_x_y.png.
+int tileCommand(const vector<string>& args, TileServer& server)
+{
+		if (args.empty() || args.size() % 3 != 0)
+		{
+				cerr << "tile expects groups of <z> <x> <y>" << endl;
+				return EXIT_FAILURE;
+		}
+		for (size_t i = 0; i < args.size(); i += 3)
+		{
+				TileKey key = { atoi(args[i].c_str()), atoi(args[i+1].c_str()), atoi(args[i+2].c_str()) };
+				if (!key.valid())
+				{
+						cerr << "invalid tile " << args[i] << " " << args[i+1] << " " << args[i+2] << endl;
+						return EXIT_FAILURE;
+				}
+				double t = (double) getTickCount();
+				double tPreview = 0;
+				TileServer::Source source = server.get(key, [&](const Mat& tile, bool final){
+						if (!final)
+								tPreview = ((double) getTickCount() - t) / getTickFrequency();
+						else
+								imwrite("tile_" + key.name() + ".png", tile);
+				});
+				t = ((double) getTickCount() - t) / getTickFrequency();
+				cout << "tile " << key.name() << ": " << sourceName(source);
+				if (source == TileServer::RENDERED)
+						cout << ", preview after " << tPreview * 1000 << " ms";
+				cout << ", done after " << t * 1000 << " ms" << endl;
+		}
+		return EXIT_SUCCESS;
+}
+
+#if MANDELBROT_HTTP
+void sendResponse(const int client, const string& status, const string& type, const vector<uchar>& body)
+{
+		ostringstream header;
+		header << "HTTP/1.0 " << status << "\r\n"
+					 << "Content-Type: " << type << "\r\n"
+					 << "Content-Length: " << body.size() << "\r\n"
+					 << "Connection: close\r\n\r\n";
+		const string h = header.str();
+		if (send(client, h.data(), h.size(), 0) < 0)
+				return;
+		size_t sent = 0;
+		while (sent < body.size())
+		{
+				ssize_t n = send(client, (const char*) &body[0] + sent, body.size() - sent, 0);
+				if (n <= 0) break;
+				sent += n;
+		}
+}
+
+// ./parallel serve [port]
+// A loopback-only HTTP stand-in for a real tile service, one request at a time:
+//   GET /tile/<z>/<x>/<y>.png            the full tile (cached)
+//   GET /tile/<z>/<x>/<y>.png?preview    the coarse pass, for progressive display
+int serveCommand(const int port, TileServer& server)
+{
+		int listener = socket(AF_INET, SOCK_STREAM, 0);
+		if (listener < 0)
+		{
+				cerr << "socket() failed" << endl;
+				return EXIT_FAILURE;
+		}
+		int yes = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t) port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (::bind(listener, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(listener, 16) < 0)
+		{
+				cerr << "cannot listen on 127.0.0.1:" << port << endl;
+				close(listener);
+				return EXIT_FAILURE;
+		}
+		cout << "Serving Mandelbrot tiles on http://127.0.0.1:" << port << "/tile/<z>/<x>/<y>.png" << endl;
+
+		// a client that hangs up early (a browser cancelling a tile while panning)
+		// must make send() fail, not kill the server with SIGPIPE
+		signal(SIGPIPE, SIG_IGN);
+
+		for (;;)
+		{
+				int client = accept(listener, 0, 0);
+				if (client < 0)
+						continue;
+
+				char request[2048];
+				ssize_t n = recv(client, request, sizeof(request) - 1, 0);
+				request[max<ssize_t>(n, 0)] = 0;
+
+				TileKey key;
+				char ext[8] = { 0 };
+				const bool isTile = sscanf(request, "GET /tile/%d/%d/%d.%3s", &key.z, &key.x, &key.y, ext) == 4
+														&& !strncmp(ext, "png", 3) && key.valid();
+				if (!isTile)
+				{
+						const string msg = "expected GET /tile/<z>/<x>/<y>.png\n";
+						sendResponse(client, "404 Not Found", "text/plain", vector<uchar>(msg.begin(), msg.end()));
+						close(client);
+						continue;
+				}
+
+				const char* lineEnd = strstr(request, " HTTP/");
+				const char* query = strchr(request, '?');
+				const bool wantPreview = query && (!lineEnd || query < lineEnd) && !strncmp(query, "?preview", 8);
+
+				double t = (double) getTickCount();
+				TileServer::Source source = TileServer::RENDERED;
+				Mat tile = wantPreview ? server.preview(key) : server.get(key, &source);
+				vector<uchar> png;
+				imencode(".png", tile, png);
+				sendResponse(client, "200 OK", "image/png", png);
+				close(client);
+
+				t = ((double) getTickCount() - t) / getTickFrequency();
+				cout << "GET tile " << key.name() << (wantPreview ? " preview" : "") << ": "
+						 << (wantPreview ? "rendered" : sourceName(source)) << ", " << t * 1000 << " ms" << endl;
+		}
+}
+#endif
+//! [mandelbrot-tile-server]
+
+//! [mandelbrot-zoom]
+// ./parallel zoom <centerX> <centerY> <pixelSize> [maxIter] [float|double|dd|perturbation]
+// The center is read as a decimal string so it can carry more digits than a double.
+int zoomCommand(const vector<string>& args)
+{
+		if (args.size() < 3)
+		{
+				cerr << "zoom expects <centerX> <centerY> <pixelSize> [maxIter] [float|double|dd|perturbation]" << endl;
+				return EXIT_FAILURE;
+		}
+		const double pixelSize = atof(args[2].c_str());
+		const int maxIter = args.size() > 3 ? atoi(args[3].c_str()) : 5000;
+		MandelbrotPrecision precision = PRECISION_AUTO;
+		if (args.size() > 4)
+		{
+				const string& p = args[4];
+				precision = p == "float" ? PRECISION_FLOAT : p == "double" ? PRECISION_DOUBLE
+									: p == "dd" ? PRECISION_DOUBLE_DOUBLE : p == "perturbation" ? PRECISION_PERTURBATION : PRECISION_AUTO;
+		}
+		if (!(pixelSize > 0) || maxIter <= 0)
+		{
+				cerr << "invalid pixel size or iteration count" << endl;
+				return EXIT_FAILURE;
+		}
+
+		const int limbs = max(4, 3 + (int) ceil(-log2(pixelSize) / 32));
+		BigFixed cx(limbs), cy(limbs);
+		if (!BigFixed::parse(args[0], limbs, cx) || !BigFixed::parse(args[1], limbs, cy))
+		{
+				cerr << "cannot parse the center" << endl;
+				return EXIT_FAILURE;
+		}
+
+		Mat img(768, 1024, CV_8U);
+		double t = (double) getTickCount();
+		precision = renderMandelbrotView(img, cx, cy, pixelSize, maxIter, precision);
+		t = ((double) getTickCount() - t) / getTickFrequency();
+		cout << "Zoom at pixel size " << pixelSize << " rendered with " << precisionName(precision)
+				 << " in " << t << " s" << endl;
+		imwrite("Mandelbrot_zoom.png", img);
+		return EXIT_SUCCESS;
+}
+//! [mandelbrot-zoom]
+}
+
+static void help(char** argv)
+{
+		cout << "Usage:" << endl
+				 << argv[0] << "                                     render the 4800x5400 image and compare the methods" << endl
+				 << argv[0] << " tile <z> <x> <y> [...] [--cache=<dir>] write 256x256 tiles of the zoomable pyramid" << endl
+				 << argv[0] << " zoom <cx> <cy> <pixelSize> [maxIter] [float|double|dd|perturbation]" << endl
+				 << "        render a 1024x768 deep zoom with the cheapest precision that resolves it" << endl
+#if MANDELBROT_HTTP
+				 << argv[0] << " serve [port] [--cache=<dir>]         serve the tiles on http://127.0.0.1:port (default 8080)" << endl
+#endif
+				 ;
+}
+
+int main(int argc, char** argv)
+{
+		//! [mandelbrot-tile-server-call]
+		if (argc > 1)
+		{
+				string command = argv[1];
+				vector<string> args;
+				string cacheDir;
+				for (int i = 2; i < argc; i++)
+				{
+						if (!strncmp(argv[i], "--cache=", 8))
+								cacheDir = argv[i] + 8;
+						else
+								args.push_back(argv[i]);
+				}
+
+				TileServer server(1024, cacheDir);
+				if (command == "tile")
+						return tileCommand(args, server);
+				if (command == "zoom")
+						return zoomCommand(args);
+#if MANDELBROT_HTTP
+				if (command == "serve")
+						return serveCommand(args.empty() ? 8080 : atoi(args[0].c_str()), server);
+#endif
+				help(argv);
+				return EXIT_FAILURE;
+		}
+		//! [mandelbrot-tile-server-call]
+
 		//! [mandelbrot-transformation]
 		Mat mandelbrotImg(4800, 5400, CV_8U);
 		float x1 = -2.1f, x2 = 0.6f;
@@ -163,6 +1475,54 @@ int main()
 		cout << "Sequential Mandelbrot: " << t2 << " s" << endl;
 		cout << "Speed-up: " << t2/t1 << " X" << endl;
 
+		//! [mandelbrot-simd-call]
+		Mat mandelbrotImgSimd(4800, 5400, CV_8U);
+		const char* simdName;
+		selectMandelbrotRow(&simdName);
+		double t5 = (double) getTickCount();
+		simdMandelbrot(mandelbrotImgSimd, x1, y1, scaleX, scaleY);
+		t5 = ((double) getTickCount() - t5) / getTickFrequency();
+		cout << "Parallel SIMD (" << simdName << ") Mandelbrot: " << t5 << " s" << endl;
+		cout << "Speed-up (SIMD): " << t2/t5 << " X" << endl;
+
+		bool identical = true;
+		for (int i = 0; i < mandelbrotImgSimd.rows && identical; i++)
+				identical = memcmp(mandelbrotImgSimd.ptr(i), mandelbrotImgSequential.ptr(i), mandelbrotImgSimd.cols) == 0;
+		cout << "SIMD image identical to the sequential one: " << (identical ? "yes" : "NO") << endl;
+		//! [mandelbrot-simd-call]
+
+		//! [mandelbrot-interior-checks-call]
+		Mat mandelbrotImgChecks(4800, 5400, CV_8U);
+		double t6 = (double) getTickCount();
+		simdMandelbrot(mandelbrotImgChecks, x1, y1, scaleX, scaleY, 500, MANDELBROT_BULB_CHECK | MANDELBROT_PERIODICITY);
+		t6 = ((double) getTickCount() - t6) / getTickFrequency();
+		cout << "Parallel SIMD Mandelbrot with cardioid/bulb and periodicity checks: " << t6 << " s" << endl;
+		cout << "Speed-up (SIMD + interior checks): " << t2/t6 << " X" << endl;
+
+		// the float cardioid/bulb test can disagree with the iteration on the boundary itself
+		int differing = 0;
+		for (int i = 0; i < mandelbrotImgChecks.rows; i++)
+				for (int j = 0; j < mandelbrotImgChecks.cols; j++)
+						differing += mandelbrotImgChecks.ptr<uchar>(i)[j] != mandelbrotImgSequential.ptr<uchar>(i)[j];
+		cout << "Pixels different from the sequential image: " << differing << endl;
+		//! [mandelbrot-interior-checks-call]
+
+		//! [mandelbrot-tiles-call]
+		Mat mandelbrotImgTiled(4800, 5400, CV_8U);
+		double t3 = (double) getTickCount();
+		vector<WorkerStats> staticStats = tiledMandelbrot(mandelbrotImgTiled, x1, y1, scaleX, scaleY, false);
+		t3 = ((double) getTickCount() - t3) / getTickFrequency();
+		cout << "Tiled Mandelbrot, static split: " << t3 << " s" << endl;
+		printWorkerStats(staticStats);
+
+		double t4 = (double) getTickCount();
+		vector<WorkerStats> stealingStats = tiledMandelbrot(mandelbrotImgTiled, x1, y1, scaleX, scaleY, true);
+		t4 = ((double) getTickCount() - t4) / getTickFrequency();
+		cout << "Tiled Mandelbrot, work stealing: " << t4 << " s" << endl;
+		printWorkerStats(stealingStats);
+		cout << "Speed-up (work stealing): " << t2/t4 << " X" << endl;
+		//! [mandelbrot-tiles-call]
+
 		imwrite("Mandelbrot_parallel.png", mandelbrotImg);
 		imwrite("Mandelbrot_sequential.png", mandelbrotImgSequential);
 
@@ -0,0 +1,658 @@
+/**
+ * @file point_ops.hpp
+ * @brief Point operations: every output pixel depends only on the same input pixel
+ *
+ *     point::gainBias(src, dst, alpha, beta);   // dst = saturate(alpha * src + beta)
+ *     point::gainBias(image, alpha, beta);      // in place
+ *
+ * Same result as src.convertTo(dst, -1, alpha, beta), any number of channels.
+ * A point operation does not care where a pixel is, so an image is just a run
+ * of values: continuous images are handed to the row functions one stripe of
+ * rows at a time, and the stripes go to the OpenCV threads.
+ *
+ * - 8U:       only 256 inputs, so alpha and beta are compiled into a table once
+ *             and every byte becomes a lookup (lutRow, vectorized with tbl
+ *             on NEON; on x86 the plain loop is as fast as a pshufb version)
+ * - 16U, 16S, 32F: a float multiply-add, clamp and round written so that the
+ *             compiler vectorizes it (-O3 -ffast-math on GCC). Like convertTo
+ *             it computes in float, so 16-bit results can be one off from the
+ *             double formula
+ *
+ * ToneCurve chains gain, bias, gamma, clamp and user curves and applies the
+ * whole chain in one pass, however long it is.
+ *
+ * applyPacked runs a point operation directly on packed camera formats
+ * (MIPI RAW10/RAW12, P010): unpack, look up and repack in one pass. On x86
+ * the AVX2 kernels are built whatever the -m flags, and used when the CPU
+ * has AVX2, as in parallel.cpp.
+ */
+
+#ifndef CORE_POINT_OPS_HPP
+#define CORE_POINT_OPS_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define POINT_X86_DISPATCH 1
+#include <immintrin.h>
+#else
+#define POINT_X86_DISPATCH 0
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace point
+{
+
+// Apply the table to n consecutive bytes. src and dst may be the same buffer.
+inline void lutRow(const uchar* src, uchar* dst, int n, const uchar* const table)
+{
+		int j = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+		// tbl/tbx look up 64 entries at once; tbx keeps the previous result for
+		// out-of-range indices, so four lookups cover the whole table
+		const uint8x16x4_t t0 = vld1q_u8_x4(table);
+		const uint8x16x4_t t1 = vld1q_u8_x4(table + 64);
+		const uint8x16x4_t t2 = vld1q_u8_x4(table + 128);
+		const uint8x16x4_t t3 = vld1q_u8_x4(table + 192);
+		const uint8x16_t step = vdupq_n_u8(64);
+		for ( ; j <= n - 16; j += 16)
+		{
+				uint8x16_t x = vld1q_u8(src + j);
+				uint8x16_t r = vqtbl4q_u8(t0, x);
+				x = vsubq_u8(x, step);
+				r = vqtbx4q_u8(r, t1, x);
+				x = vsubq_u8(x, step);
+				r = vqtbx4q_u8(r, t2, x);
+				x = vsubq_u8(x, step);
+				r = vqtbx4q_u8(r, t3, x);
+				vst1q_u8(dst + j, r);
+		}
+#endif
+		for ( ; j <= n - 4; j += 4)
+		{
+				uchar v0 = table[src[j]], v1 = table[src[j+1]];
+				uchar v2 = table[src[j+2]], v3 = table[src[j+3]];
+				dst[j] = v0; dst[j+1] = v1; dst[j+2] = v2; dst[j+3] = v3;
+		}
+		for ( ; j < n; ++j)
+				dst[j] = table[src[j]];
+}
+
+// Calls row(in, out, n) over every value of src and the matching ones of dst
+// (already allocated, same size and depth), in stripes of about 64 KB spread
+// over the threads. When both images are continuous a stripe of rows is one
+// call, otherwise one call per row. T is the element type of src, U of dst.
+template<typename T, typename U, typename RowFunc>
+void forEachRun(const cv::Mat& src, cv::Mat& dst, RowFunc row)
+{
+		CV_Assert(src.size() == dst.size());
+		const int n = src.cols * src.channels();
+		const bool continuous = src.isContinuous() && dst.isContinuous();
+		cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range){
+				if (continuous)
+				{
+						row(src.ptr<T>(range.start), dst.ptr<U>(range.start), n * (range.end - range.start));
+						return;
+				}
+				for (int i = range.start; i < range.end; ++i)
+						row(src.ptr<T>(i), dst.ptr<U>(i), n);
+		}, (double)src.total() * src.elemSize() / (1 << 16));
+}
+
+namespace detail
+{
+// round and saturate without cvRound, which the compiler does not vectorize.
+// GCC turns the float min/max into vector instructions only with
+// -fno-trapping-math (implied by -ffast-math); clang does by default.
+template<typename T> struct Saturate
+{
+		static T run(float v) { return (T)v; }
+};
+
+template<> struct Saturate<ushort>
+{
+		static ushort run(float v) { return (ushort)(int)(std::min(std::max(v, 0.f), 65535.f) + 0.5f); }
+};
+
+template<> struct Saturate<short>
+{
+		static short run(float v)
+		{
+				v = std::min(std::max(v, -32768.f), 32767.f);
+				return (short)(int)(v + (v < 0 ? -0.5f : 0.5f));
+		}
+};
+
+template<typename T>
+void gainBiasRow(const T* src, T* dst, int n, float alpha, float beta)
+{
+		for (int j = 0; j < n; ++j)
+				dst[j] = Saturate<T>::run(alpha * (float)src[j] + beta);
+}
+
+template<typename T>
+void gainBias(const cv::Mat& src, cv::Mat& dst, float alpha, float beta)
+{
+		forEachRun<T, T>(src, dst, [=](const T* in, T* out, int n){ gainBiasRow(in, out, n, alpha, beta); });
+}
+} // namespace detail
+
+// table[i] = saturate(alpha * i + beta), exactly what the tutorial's loop computes
+inline void gainBiasTable(double alpha, double beta, uchar* table)
+{
+		for (int i = 0; i < 256; ++i)
+				table[i] = cv::saturate_cast<uchar>(alpha * i + beta);
+}
+
+// dst = saturate(alpha * src + beta). dst is (re)allocated only if its size or
+// type differ; src and dst may be the same Mat.
+inline void gainBias(const cv::Mat& src, cv::Mat& dst, double alpha, double beta)
+{
+		dst.create(src.size(), src.type());
+		switch (src.depth())
+		{
+		case CV_8U:
+				{
+						uchar table[256];
+						gainBiasTable(alpha, beta, table);
+						forEachRun<uchar, uchar>(src, dst, [&](const uchar* in, uchar* out, int n){ lutRow(in, out, n, table); });
+						break;
+				}
+		case CV_16U: detail::gainBias<ushort>(src, dst, (float)alpha, (float)beta); break;
+		case CV_16S: detail::gainBias<short>(src, dst, (float)alpha, (float)beta); break;
+		case CV_32F: detail::gainBias<float>(src, dst, (float)alpha, (float)beta); break;
+		default:
+				CV_Error(cv::Error::StsUnsupportedFormat, "point::gainBias: 8U, 16U, 16S or 32F only");
+		}
+}
+
+inline cv::Mat& gainBias(cv::Mat& image, double alpha, double beta)
+{
+		gainBias(image, image, alpha, beta);
+		return image;
+}
+
+// Piecewise cubic approximation of a curve on [lo, hi]. The segments have equal
+// width in u = sqrt((x - lo) / (hi - lo)), so they are narrow near lo, where
+// gamma curves are steep; inputs outside [lo, hi] are clamped to it first.
+struct PiecewiseCubic
+{
+		float lo, invRange;
+		int segments;
+		std::vector<float> coeffs;  // per segment c0 + t*(c1 + t*(c2 + t*c3)), t in [0, 1)
+};
+
+namespace detail
+{
+// Vectorizes with gathers for the coefficients (AVX2); GCC also needs
+// -fno-math-errno for the sqrt, see Saturate for the clamp.
+template<typename T>
+void cubicRow(const T* src, T* dst, int n, const PiecewiseCubic& p)
+{
+		const float* c = &p.coeffs[0];
+		const float lo = p.lo, invRange = p.invRange, segments = (float)p.segments;
+		const int last = p.segments - 1;
+		for (int j = 0; j < n; ++j)
+		{
+				const float x = std::min(std::max(((float)src[j] - lo) * invRange, 0.f), 1.f);
+				const float u = std::sqrt(x) * segments;
+				const int k = std::min((int)u, last);
+				const float t = u - (float)k;
+				const int i = 4 * k;
+				dst[j] = Saturate<T>::run(c[i] + t * (c[i + 1] + t * (c[i + 2] + t * c[i + 3])));
+		}
+}
+
+template<typename T>
+void cubic(const cv::Mat& src, cv::Mat& dst, const PiecewiseCubic& p)
+{
+		forEachRun<T, T>(src, dst, [&](const T* in, T* out, int n){ cubicRow(in, out, n, p); });
+}
+} // namespace detail
+
+// A chain of point operations applied in the order they are added, in pixel
+// units (0..255 for 8-bit, 0..65535 for 16U, usually 0..1 for float):
+//
+//     point::ToneCurve exposure;
+//     exposure.gain(1.2).bias(-10).gamma(1 / 2.2).clamp(16, 235);
+//     exposure.apply(frame, frame);
+//
+// apply() does not run the steps one after the other. For 8-bit the chain is
+// evaluated once per possible input into a 256-entry table and applied with
+// lutRow; for 16-bit and float it is fitted with a PiecewiseCubic and every
+// pixel costs one cubic. Either way N steps cost one pass over the image.
+class ToneCurve
+{
+public:
+		ToneCurve& gain(double alpha)
+		{
+				return add(GAIN, alpha, 0);
+		}
+
+		ToneCurve& bias(double beta)
+		{
+				return add(BIAS, beta, 0);
+		}
+
+		// white * (v / white)^g, negative values become 0
+		ToneCurve& gamma(double g, double white = 255)
+		{
+				CV_Assert(g > 0 && white > 0);
+				return add(GAMMA, g, white);
+		}
+
+		ToneCurve& clamp(double lo, double hi)
+		{
+				CV_Assert(lo <= hi);
+				return add(CLAMP, lo, hi);
+		}
+
+		// piecewise linear through the (input, output) points, which must be sorted
+		// by input; constant before the first point and after the last one
+		ToneCurve& curve(const std::vector<cv::Point2d>& points)
+		{
+				CV_Assert(!points.empty());
+				for (size_t i = 1; i < points.size(); ++i)
+						CV_Assert(points[i - 1].x <= points[i].x);
+				add(CURVE, (double)m_points.size(), (double)points.size());
+				m_points.insert(m_points.end(), points.begin(), points.end());
+				return *this;
+		}
+
+		// the chain applied to one value, exactly
+		double operator()(double v) const
+		{
+				for (size_t i = 0; i < m_steps.size(); ++i)
+				{
+						const Step& s = m_steps[i];
+						switch (s.op)
+						{
+						case GAIN:  v *= s.a; break;
+						case BIAS:  v += s.a; break;
+						case GAMMA: v = v > 0 ? s.b * std::pow(v / s.b, s.a) : 0; break;
+						case CLAMP: v = std::min(std::max(v, s.a), s.b); break;
+						case CURVE: v = interpolate(&m_points[(size_t)s.a], (size_t)s.b, v); break;
+						}
+				}
+				return v;
+		}
+
+		// table[i] = saturate(chain(i))
+		void table(uchar* table) const
+		{
+				for (int i = 0; i < 256; ++i)
+						table[i] = cv::saturate_cast<uchar>((*this)(i));
+		}
+
+		// table[i] = chain(i) rounded and clamped to [0, 2^bits - 1], for i < 2^bits
+		void table(int bits, int* table) const
+		{
+				CV_Assert(bits > 0 && bits <= 16);
+				const int top = (1 << bits) - 1;
+				for (int i = 0; i <= top; ++i)
+						table[i] = std::min(std::max(cvRound((*this)(i)), 0), top);
+		}
+
+		// The cubic of each segment goes through the exact chain at t = 0, 1/3, 2/3
+		// and 1, so consecutive segments meet. With 4096 segments gamma curves and
+		// the kinks of clamp and curve stay within a few 16-bit codes
+		// (linear_transforms --bench prints the worst one).
+		PiecewiseCubic compile(double lo, double hi, int segments = 4096) const
+		{
+				CV_Assert(lo < hi && segments > 0);
+				PiecewiseCubic p;
+				p.lo = (float)lo;
+				p.invRange = (float)(1.0 / (hi - lo));
+				p.segments = segments;
+				p.coeffs.resize((size_t)segments * 4);
+				for (int k = 0; k < segments; ++k)
+				{
+						double y[4];
+						for (int i = 0; i < 4; ++i)
+						{
+								const double u = (k + i / 3.0) / segments;
+								y[i] = (*this)(lo + u * u * (hi - lo));
+						}
+						// Newton's forward differences in s = 3t, then expanded in t
+						const double d1 = y[1] - y[0], d2 = y[2] - 2 * y[1] + y[0], d3 = y[3] - 3 * y[2] + 3 * y[1] - y[0];
+						float* c = &p.coeffs[(size_t)k * 4];
+						c[0] = (float)y[0];
+						c[1] = (float)(3 * (d1 - d2 / 2 + d3 / 3));
+						c[2] = (float)(9 * (d2 - d3) / 2);
+						c[3] = (float)(27 * d3 / 6);
+				}
+				return p;
+		}
+
+		// dst = chain(src) for 8U, 16U, 16S or 32F images, in place too. The 16-bit
+		// cubic spans the whole type; for float [floatLo, floatHi] is the input
+		// range, values outside it are clamped into it.
+		void apply(const cv::Mat& src, cv::Mat& dst, double floatLo = 0, double floatHi = 1) const
+		{
+				dst.create(src.size(), src.type());
+				switch (src.depth())
+				{
+				case CV_8U:
+						{
+								uchar t[256];
+								table(t);
+								forEachRun<uchar, uchar>(src, dst, [&](const uchar* in, uchar* out, int n){ lutRow(in, out, n, t); });
+								break;
+						}
+				case CV_16U: detail::cubic<ushort>(src, dst, compile(0, 65535)); break;
+				case CV_16S: detail::cubic<short>(src, dst, compile(-32768, 32767)); break;
+				case CV_32F: detail::cubic<float>(src, dst, compile(floatLo, floatHi)); break;
+				default:
+						CV_Error(cv::Error::StsUnsupportedFormat, "point::ToneCurve: 8U, 16U, 16S or 32F only");
+				}
+		}
+
+private:
+		enum Op { GAIN, BIAS, GAMMA, CLAMP, CURVE };
+
+		struct Step
+		{
+				int op;
+				double a, b;  // CURVE: first point and number of points in m_points
+		};
+
+		ToneCurve& add(int op, double a, double b)
+		{
+				Step s = { op, a, b };
+				m_steps.push_back(s);
+				return *this;
+		}
+
+		static double interpolate(const cv::Point2d* p, size_t n, double v)
+		{
+				if (v <= p[0].x)
+						return p[0].y;
+				for (size_t i = 1; i < n; ++i)
+						if (v < p[i].x)
+								return p[i - 1].y + (v - p[i - 1].x) * (p[i].y - p[i - 1].y) / (p[i].x - p[i - 1].x);
+				return p[n - 1].y;
+		}
+
+		std::vector<Step> m_steps;
+		std::vector<cv::Point2d> m_points;
+};
+
+//************* [packed] *****************
+// Packed camera formats. A RAW10 or RAW12 frame is a CV_8UC1 Mat holding the
+// packed bytes of each row, a P010 plane is CV_16UC1:
+//
+// - RAW10: 4 pixels in 5 bytes, the high 8 bits of each pixel, then a byte
+//          with the low 2 bits of pixel 0 in bits 0-1, pixel 1 in 2-3, ...
+// - RAW12: 2 pixels in 3 bytes, the high 8 bits of each, then a byte with the
+//          low 4 bits of pixel 0 in bits 0-3 and of pixel 1 in 4-7
+// - P010:  one 16-bit word per sample, the 10 bits in the top of the word
+enum PackedFormat { PACKED_RAW10 = 0, PACKED_RAW12 = 1, PACKED_P010 = 2 };
+
+inline int packedBits(int format)
+{
+		return format == PACKED_RAW12 ? 12 : 10;
+}
+
+// packed bytes (words for P010) per row of width pixels
+inline int packedCols(int format, int width)
+{
+		switch (format)
+		{
+		case PACKED_RAW10: CV_Assert(width % 4 == 0); return width / 4 * 5;
+		case PACKED_RAW12: CV_Assert(width % 2 == 0); return width / 2 * 3;
+		case PACKED_P010:  return width;
+		default:
+				CV_Error(cv::Error::StsBadArg, "point: unknown packed format");
+		}
+		return 0;
+}
+
+inline int packedWidth(int format, int cols)
+{
+		return format == PACKED_RAW10 ? cols / 5 * 4 : format == PACKED_RAW12 ? cols / 3 * 2 : cols;
+}
+
+namespace detail
+{
+inline void checkPacked(const cv::Mat& packed, int format)
+{
+		CV_Assert(packed.type() == (format == PACKED_P010 ? CV_16UC1 : CV_8UC1));
+		CV_Assert(packedCols(format, packedWidth(format, packed.cols)) == packed.cols);
+}
+
+// One group of pixels (4 for RAW10, 2 for RAW12), unpacked into v and packed back
+// from v; the reference for the vector code below.
+inline void unpackGroup(const uchar* p, int format, int* v)
+{
+		if (format == PACKED_RAW10)
+				for (int m = 0; m < 4; ++m)
+						v[m] = (p[m] << 2) | ((p[4] >> (2 * m)) & 3);
+		else
+		{
+				v[0] = (p[0] << 4) | (p[2] & 15);
+				v[1] = (p[1] << 4) | (p[2] >> 4);
+		}
+}
+
+inline void packGroup(const int* v, int format, uchar* p)
+{
+		if (format == PACKED_RAW10)
+		{
+				p[0] = (uchar)(v[0] >> 2); p[1] = (uchar)(v[1] >> 2);
+				p[2] = (uchar)(v[2] >> 2); p[3] = (uchar)(v[3] >> 2);
+				p[4] = (uchar)((v[0] & 3) | (v[1] & 3) << 2 | (v[2] & 3) << 4 | (v[3] & 3) << 6);
+		}
+		else
+		{
+				p[0] = (uchar)(v[0] >> 4);
+				p[1] = (uchar)(v[1] >> 4);
+				p[2] = (uchar)((v[0] & 15) | (v[1] & 15) << 4);
+		}
+}
+
+#if POINT_X86_DISPATCH
+inline bool hasAvx2()
+{
+		static const bool avx2 = cv::checkHardwareSupport(CV_CPU_AVX2);
+		return avx2;
+}
+
+// 8 pixels per step, all in registers: 10 (RAW10) or 12 (RAW12) bytes are
+// spread into one 32-bit lane per pixel, high byte over the byte holding the
+// low bits, so that the pixel is (lane >> 8) << LowBits | (lane >> shift) & mask.
+// The table is read with a gather, and the result goes back the same way:
+// the low bits of the pixels of a group are shifted into place and OR-ed
+// across the group's lanes, then one shuffle per 128-bit half picks the bytes.
+// Returns the number of bytes done; the caller finishes the row.
+template<int Bits>
+__attribute__((target("avx2")))
+int lutPackedAvx2(const uchar* src, uchar* dst, int n, const int* table)
+{
+		const int LowBits = Bits - 8, StepBytes = Bits == 10 ? 10 : 12;
+		const __m256i unpackIdx = Bits == 10
+				? _mm256_setr_epi8(4, 0, -1, -1, 4, 1, -1, -1, 4, 2, -1, -1, 4, 3, -1, -1,
+													 9, 5, -1, -1, 9, 6, -1, -1, 9, 7, -1, -1, 9, 8, -1, -1)
+				: _mm256_setr_epi8(2, 0, -1, -1, 2, 1, -1, -1, 5, 3, -1, -1, 5, 4, -1, -1,
+													 8, 6, -1, -1, 8, 7, -1, -1, 11, 9, -1, -1, 11, 10, -1, -1);
+		const __m256i shifts = Bits == 10 ? _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)
+																			: _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4);
+		// the same pattern in each half: hi bytes (byte 0 of a lane), then the low byte (byte 1)
+		const __m256i packIdx = Bits == 10
+				? _mm256_setr_epi8(0, 4, 8, 12, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+													 0, 4, 8, 12, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+				: _mm256_setr_epi8(0, 4, 1, 8, 12, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+													 0, 4, 1, 8, 12, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+		const __m256i lowMask = _mm256_set1_epi32((1 << LowBits) - 1);
+		const __m256i byteMask = _mm256_set1_epi32(255);
+
+		int j = 0;
+		// 16-byte loads: stop while a full load still fits in the row
+		for ( ; j <= n - 16; j += StepBytes)
+		{
+				const __m256i x = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(src + j)));
+				const __m256i lane = _mm256_shuffle_epi8(x, unpackIdx);
+				const __m256i v = _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(lane, 8), LowBits),
+																					_mm256_and_si256(_mm256_srlv_epi32(lane, shifts), lowMask));
+				const __m256i r = _mm256_i32gather_epi32(table, v, 4);
+
+				__m256i low = _mm256_sllv_epi32(_mm256_and_si256(r, lowMask), shifts);
+				low = _mm256_or_si256(low, _mm256_shuffle_epi32(low, 0xB1));
+				if (Bits == 10)
+						low = _mm256_or_si256(low, _mm256_shuffle_epi32(low, 0x4E));
+				const __m256i bytes = _mm256_shuffle_epi8(
+						_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(r, LowBits), byteMask), _mm256_slli_epi32(low, 8)), packIdx);
+				const __m128i out = _mm_or_si128(_mm256_castsi256_si128(bytes),
+																				 _mm_slli_si128(_mm256_extracti128_si256(bytes, 1), StepBytes / 2));
+				// exactly StepBytes bytes, so that src == dst works
+				_mm_storel_epi64((__m128i*)(dst + j), out);
+				if (Bits == 10)
+				{
+						const short tail = (short)_mm_extract_epi16(out, 4);
+						std::memcpy(dst + j + 8, &tail, 2);
+				}
+				else
+				{
+						const int tail = _mm_extract_epi32(out, 2);
+						std::memcpy(dst + j + 8, &tail, 4);
+				}
+		}
+		return j;
+}
+
+// 16 samples per step: shift down, gather, shift back up
+__attribute__((target("avx2")))
+inline int lutP010Avx2(const ushort* src, ushort* dst, int n, const int* table)
+{
+		int j = 0;
+		for ( ; j <= n - 16; j += 16)
+		{
+				const __m256i v = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i*)(src + j)), 6);
+				const __m256i r0 = _mm256_i32gather_epi32(table, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), 4);
+				const __m256i r1 = _mm256_i32gather_epi32(table, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), 4);
+				// packus works per 128-bit half, the permute puts the quarters back in order
+				const __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r0, r1), 0xD8);
+				_mm256_storeu_si256((__m256i*)(dst + j), _mm256_slli_epi16(r, 6));
+		}
+		return j;
+}
+#endif
+
+// n packed bytes of RAW10/RAW12 through the table, src == dst allowed
+inline void lutPackedRow(const uchar* src, uchar* dst, int n, int format, const int* table)
+{
+		const int groupBytes = format == PACKED_RAW10 ? 5 : 3, groupPixels = format == PACKED_RAW10 ? 4 : 2;
+		int j = 0;
+#if POINT_X86_DISPATCH
+		if (hasAvx2())
+				j = format == PACKED_RAW10 ? lutPackedAvx2<10>(src, dst, n, table) : lutPackedAvx2<12>(src, dst, n, table);
+#endif
+		int v[4];
+		for ( ; j < n; j += groupBytes)
+		{
+				unpackGroup(src + j, format, v);
+				for (int m = 0; m < groupPixels; ++m)
+						v[m] = table[v[m]];
+				packGroup(v, format, dst + j);
+		}
+}
+
+inline void lutP010Row(const ushort* src, ushort* dst, int n, const int* table)
+{
+		int j = 0;
+#if POINT_X86_DISPATCH
+		if (hasAvx2())
+				j = lutP010Avx2(src, dst, n, table);
+#endif
+		for ( ; j < n; ++j)
+				dst[j] = (ushort)(table[src[j] >> 6] << 6);
+}
+} // namespace detail
+
+// dst = table[src] for every pixel of a packed frame, without unpacking it into
+// a separate buffer. The table has 2^packedBits(format) entries, each smaller
+// than that; src and dst may be the same Mat.
+inline void applyPacked(const cv::Mat& src, cv::Mat& dst, int format, const int* table)
+{
+		detail::checkPacked(src, format);
+		dst.create(src.size(), src.type());
+		if (format == PACKED_P010)
+				forEachRun<ushort, ushort>(src, dst, [&](const ushort* in, ushort* out, int n){ detail::lutP010Row(in, out, n, table); });
+		else
+				forEachRun<uchar, uchar>(src, dst, [&](const uchar* in, uchar* out, int n){ detail::lutPackedRow(in, out, n, format, table); });
+}
+
+// any ToneCurve (gain, bias, clamp, ...) in sample units, 0 .. 2^bits - 1
+inline void applyPacked(const cv::Mat& src, cv::Mat& dst, int format, const ToneCurve& curve)
+{
+		std::vector<int> table((size_t)1 << packedBits(format));
+		curve.table(packedBits(format), &table[0]);
+		applyPacked(src, dst, format, &table[0]);
+}
+
+// The unfused path: one CV_16UC1 sample per pixel, and back
+inline void unpackPacked(const cv::Mat& src, int format, cv::Mat& samples)
+{
+		detail::checkPacked(src, format);
+		samples.create(src.rows, packedWidth(format, src.cols), CV_16UC1);
+		const int groupBytes = format == PACKED_RAW10 ? 5 : 3, groupPixels = format == PACKED_RAW10 ? 4 : 2;
+		cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range){
+				int v[4];
+				for (int i = range.start; i < range.end; ++i)
+				{
+						ushort* out = samples.ptr<ushort>(i);
+						if (format == PACKED_P010)
+						{
+								const ushort* in = src.ptr<ushort>(i);
+								for (int j = 0; j < src.cols; ++j)
+										out[j] = (ushort)(in[j] >> 6);
+								continue;
+						}
+						const uchar* in = src.ptr<uchar>(i);
+						for (int j = 0; j < src.cols; j += groupBytes, out += groupPixels)
+						{
+								detail::unpackGroup(in + j, format, v);
+								for (int m = 0; m < groupPixels; ++m)
+										out[m] = (ushort)v[m];
+						}
+				}
+		});
+}
+
+inline void packPacked(const cv::Mat& samples, int format, cv::Mat& dst)
+{
+		CV_Assert(samples.type() == CV_16UC1);
+		dst.create(samples.rows, packedCols(format, samples.cols), format == PACKED_P010 ? CV_16UC1 : CV_8UC1);
+		const int groupBytes = format == PACKED_RAW10 ? 5 : 3, groupPixels = format == PACKED_RAW10 ? 4 : 2;
+		cv::parallel_for_(cv::Range(0, samples.rows), [&](const cv::Range& range){
+				int v[4];
+				for (int i = range.start; i < range.end; ++i)
+				{
+						const ushort* in = samples.ptr<ushort>(i);
+						if (format == PACKED_P010)
+						{
+								ushort* out = dst.ptr<ushort>(i);
+								for (int j = 0; j < samples.cols; ++j)
+										out[j] = (ushort)(in[j] << 6);
+								continue;
+						}
+						uchar* out = dst.ptr<uchar>(i);
+						for (int j = 0; j < dst.cols; j += groupBytes, in += groupPixels)
+						{
+								for (int m = 0; m < groupPixels; ++m)
+										v[m] = in[m];
+								detail::packGroup(v, format, out + j);
+						}
+				}
+		});
+}
+
+} // namespace point
+
+#endif // CORE_POINT_OPS_HPP
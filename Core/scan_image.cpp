@@ -4,6 +4,10 @@
 #include <opencv2/highgui.hpp>
 #include <iostream>
 #include <sstream>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "point_ops.hpp"
 
 using namespace std;
 using namespace cv;
@@ -16,8 +20,9 @@ static void help()
 				<< " we take an input image and divide the native color palette (255) with the "  << endl
 				<< "input. Shows C operator[] method, iterators and at function for on-the-fly item address calculation."<< endl
 				<< "Usage:"                                                                       << endl
-				<< "./how_to_scan_images <imageNameToUse> <divideWith> [G]"                       << endl
+				<< "./how_to_scan_images <imageNameToUse> <divideWith> [G] [--json=<file>]"       << endl
 				<< "if you add a G parameter the image is processed in gray scale"                << endl
+				<< "--json=<file> also writes every timing sample to <file> for comparing runs"   << endl
 				<< "--------------------------------------------------------------------------"   << endl
 				<< endl;
 }
@@ -26,6 +31,24 @@ static void help()
 Mat& ScanImageAndReduceC(Mat& I, const uchar* table);
 Mat& ScanImageAndReduceIterator(Mat& I, const uchar* table);
 Mat& ScanImageAndReduceRandomAccess(Mat& I, const uchar * table);
+// and the multi-threaded, vectorized lookup table engine
+void applyLut(const Mat& src, Mat& dst, const uchar* table);
+Mat& applyLut(Mat& I, const uchar* table);
+
+// one 256-entry table per channel: tables[c] is applied to channel c
+void applyLutPerChannel(const Mat& src, Mat& dst, const uchar* const* tables);
+
+// 3D color lookup table (film-look LUT) for BGR images.
+// The cube has size^3 nodes; node (b, g, r) stores the output B, G, R at
+// data[((b*size + g)*size + r)*3 + 0..2], r running fastest.
+// Input values between the nodes are interpolated trilinearly.
+struct Lut3D
+{
+		int size;
+		vector<uchar> data;
+};
+void applyLut3D(const Mat& src, Mat& dst, const Lut3D& lut);
+Lut3D makeFilmLookLut3D(int size);
 
 int main( int argc, char* argv[])
 {
@@ -36,8 +59,19 @@ int main( int argc, char* argv[])
 				return -1;
 		}
 
+		// optional arguments after <divideWith>, in any order
+		bool gray = false;
+		string jsonFile;
+		for (int i = 3; i < argc; ++i)
+		{
+				if (!strcmp(argv[i], "G"))
+						gray = true;
+				else if (!strncmp(argv[i], "--json=", 7))
+						jsonFile = argv[i] + 7;
+		}
+
 		Mat I, J;
-		if( argc == 4 && !strcmp(argv[3],"G") )
+		if( gray )
 				I = imread(argv[1], IMREAD_GRAYSCALE);
 		else
 				I = imread(argv[1], IMREAD_COLOR);
@@ -74,57 +108,30 @@ int main( int argc, char* argv[])
 			 table[i] = (uchar)(divideWith * (i/divideWith));
 		//! [dividewith]
 
-		//********************time for 4 methods***********************
-		//******** 1 **********
-
-		const int times = 100;
-		double t;
+		//********************time the methods***********************
+		// Every method is timed by the benchmark harness: a few warm-up calls, then
+		// one sample per call. The in-place methods work on `work`, which is allocated
+		// once here and refreshed from I before every sample outside the timed region,
+		// so the numbers contain neither the clone nor its allocation.
+		bench::Benchmark benchmark("scan_image");
+		const double bytes = (double)I.total() * I.elemSize();
+		Mat work = I.clone();
+		J.create(I.size(), I.type());
 
-		t = (double)getTickCount();
-
-		for (int i = 0; i < times; ++i)
-		{
-				cv::Mat clone_i = I.clone();
-				J = ScanImageAndReduceC(clone_i, table);
-		}
-
-		t = 1000*((double)getTickCount() - t)/getTickFrequency();
-		t /= times;
-
-		cout << "Time of reducing with the C operator [] (averaged for "
-				 << times << " runs): " << t << " milliseconds."<< endl;
+		//******** 1 **********
+		benchmark.run("C operator []", bytes,
+				[&]{ I.copyTo(work); },
+				[&]{ ScanImageAndReduceC(work, table); });
 
 		//******** 2 **********
-
-		t = (double)getTickCount();
-
-		for (int i = 0; i < times; ++i)
-		{
-				cv::Mat clone_i = I.clone();
-				J = ScanImageAndReduceIterator(clone_i, table);
-		}
-
-		t = 1000*((double)getTickCount() - t)/getTickFrequency();
-		t /= times;
-
-		cout << "Time of reducing with the iterator (averaged for "
-				<< times << " runs): " << t << " milliseconds."<< endl;
+		benchmark.run("iterator", bytes,
+				[&]{ I.copyTo(work); },
+				[&]{ ScanImageAndReduceIterator(work, table); });
 
 		//******** 3 **********
-
-		t = (double)getTickCount();
-
-		for (int i = 0; i < times; ++i)
-		{
-				cv::Mat clone_i = I.clone();
-				ScanImageAndReduceRandomAccess(clone_i, table);
-		}
-
-		t = 1000*((double)getTickCount() - t)/getTickFrequency();
-		t /= times;
-
-		cout << "Time of reducing with the on-the-fly address generation - at function (averaged for "
-				<< times << " runs): " << t << " milliseconds."<< endl;
+		benchmark.run("at function", bytes,
+				[&]{ I.copyTo(work); },
+				[&]{ ScanImageAndReduceRandomAccess(work, table); });
 
 		//! [table-init]
 		Mat lookUpTable(1, 256, CV_8U);
@@ -134,20 +141,63 @@ int main( int argc, char* argv[])
 		//! [table-init]
 
 		//******** 4 **********
-
-		t = (double)getTickCount();
-
-		for (int i = 0; i < times; ++i)
+		benchmark.run("LUT function", bytes, [&]{
 				//! [table-use]
 				// LUT： built-in function Performs a look-up table transform of an array.
 				LUT(I, lookUpTable, J);
 				//! [table-use]
+		});
+
+		//******** 5 **********
+		// J already has the size and type of I, so applyLut writes into it without allocating
+		benchmark.run("applyLut", bytes, [&]{ applyLut(I, J, table); });
+
+		//********************per-channel and 3D tables***********************
+
+		//! [per-channel-table-init]
+		// a different table for every channel: reduce, then scale each channel a bit
+		// differently (cooler blue, warmer red) like a simple color grade
+		const int nChannels = I.channels();
+		vector<Mat> channelLuts(nChannels);
+		vector<const uchar*> channelTables(nChannels);
+		for (int c = 0; c < nChannels; ++c)
+		{
+				channelLuts[c].create(1, 256, CV_8U);
+				uchar* q = channelLuts[c].ptr();
+				for (int i = 0; i < 256; ++i)
+						q[i] = saturate_cast<uchar>(table[i] * (0.9 + 0.1*c));
+				channelTables[c] = q;
+		}
+		//! [per-channel-table-init]
+
+		//******** 6 **********
+		// what the pipeline does today: split, one LUT call per plane, merge
+		vector<Mat> planes;
+		benchmark.run("split + LUT + merge", bytes, [&]{
+				split(I, planes);
+				for (int c = 0; c < nChannels; ++c)
+						LUT(planes[c], channelLuts[c], planes[c]);
+				merge(planes, J);
+		});
+
+		//******** 7 **********
+		benchmark.run("applyLutPerChannel", bytes, [&]{ applyLutPerChannel(I, J, &channelTables[0]); });
+
+		//******** 8 **********
+		if (nChannels == 3)
+		{
+				Lut3D filmLook = makeFilmLookLut3D(33);
+				benchmark.run("applyLut3D 33^3", bytes, [&]{ applyLut3D(I, J, filmLook); });
+		}
 
-		t = 1000*((double)getTickCount() - t)/getTickFrequency();
-		t /= times;
+		cout << endl;
+		benchmark.print(cout);
 
-		cout << "Time of reducing with the LUT function (averaged for "
-				<< times << " runs): " << t << " milliseconds."<< endl;
+		if (!jsonFile.empty() && !benchmark.writeJson(jsonFile))
+		{
+				cout << "Could not write " << jsonFile << endl;
+				return -1;
+		}
 		return 0;
 }
 
@@ -265,3 +315,205 @@ Mat& ScanImageAndReduceRandomAccess(Mat& I, const uchar* const table)
 		return I;
 }
 //! [scan-random]
+
+//! [scan-parallel-lut]
+namespace
+{
+// Each thread gets a band of rows. When both images are continuous a band of
+// rows is a single run of bytes, so it is handed to point::lutRow in one call.
+class ParallelLut : public ParallelLoopBody
+{
+public:
+		ParallelLut (const Mat &src, Mat &dst, const uchar* table)
+				: m_src(src), m_dst(dst), m_table(table)
+		{
+		}
+
+		virtual void operator ()(const Range& range) const CV_OVERRIDE
+		{
+				const int rowBytes = m_src.cols * m_src.channels();
+				if (m_src.isContinuous() && m_dst.isContinuous())
+				{
+						point::lutRow(m_src.ptr<uchar>(range.start), m_dst.ptr<uchar>(range.start),
+									        rowBytes * (range.end - range.start), m_table);
+						return;
+				}
+				for (int i = range.start; i < range.end; i++)
+						point::lutRow(m_src.ptr<uchar>(i), m_dst.ptr<uchar>(i), rowBytes, m_table);
+		}
+
+		ParallelLut& operator=(const ParallelLut &) {
+				return *this;
+		};
+
+private:
+		const Mat &m_src;
+		Mat &m_dst;
+		const uchar* m_table;
+};
+}
+
+// dst = table[src] for every byte of an 8-bit image with any number of channels.
+// dst is (re)allocated only if its size or type differ from src; passing the same
+// Mat as src and dst (or using the overload below) transforms the image in place.
+void applyLut(const Mat& src, Mat& dst, const uchar* const table)
+{
+		// accept only char type matrices
+		CV_Assert(src.depth() == CV_8U);
+		CV_Assert(table != 0);
+
+		dst.create(src.size(), src.type());
+
+		// about 64 KB of pixels per stripe: big enough to amortize the scheduling,
+		// small enough to keep all the threads busy on small images
+		const double stripeBytes = 1 << 16;
+		const double nstripes = (double)src.total() * src.elemSize() / stripeBytes;
+
+		ParallelLut parallelLut(src, dst, table);
+		parallel_for_(Range(0, src.rows), parallelLut, nstripes);
+}
+
+Mat& applyLut(Mat& I, const uchar* const table)
+{
+		applyLut(I, I, table);
+		return I;
+}
+//! [scan-parallel-lut]
+
+//! [scan-per-channel-lut]
+void applyLutPerChannel(const Mat& src, Mat& dst, const uchar* const* const tables)
+{
+		// accept only char type matrices
+		CV_Assert(src.depth() == CV_8U);
+
+		const int cn = src.channels();
+		bool sameTable = true;
+		for (int c = 1; c < cn; ++c)
+				sameTable = sameTable && tables[c] == tables[0];
+		if (sameTable)
+		{
+				// nothing channel specific, use the vectorized single table path
+				applyLut(src, dst, tables[0]);
+				return;
+		}
+
+		dst.create(src.size(), src.type());
+
+		// the pixel loop reads every pixel once and writes it once,
+		// channel c of each pixel going through tables[c]
+		parallel_for_(Range(0, src.rows), [&](const Range& range){
+				for (int i = range.start; i < range.end; i++)
+				{
+						const uchar* p = src.ptr<uchar>(i);
+						uchar* q = dst.ptr<uchar>(i);
+						if (cn == 3)
+						{
+								const uchar *t0 = tables[0], *t1 = tables[1], *t2 = tables[2];
+								for (int j = 0; j < src.cols; ++j, p += 3, q += 3)
+								{
+										uchar b = t0[p[0]], g = t1[p[1]], r = t2[p[2]];
+										q[0] = b; q[1] = g; q[2] = r;
+								}
+						}
+						else
+						{
+								for (int j = 0; j < src.cols; ++j, p += cn, q += cn)
+										for (int c = 0; c < cn; ++c)
+												q[c] = tables[c][p[c]];
+						}
+				}
+		}, (double)src.total() * src.elemSize() / (1 << 16));
+}
+//! [scan-per-channel-lut]
+
+//! [scan-3d-lut]
+// An example film look: a gentle S-curve on contrast, a little desaturation and
+// warmer highlights. Any .cube file could be loaded into a Lut3D the same way.
+Lut3D makeFilmLookLut3D(int size)
+{
+		CV_Assert(size >= 2 && size <= 256);
+
+		Lut3D lut;
+		lut.size = size;
+		lut.data.resize((size_t)size*size*size*3);
+
+		uchar* q = &lut.data[0];
+		for (int ib = 0; ib < size; ++ib)
+				for (int ig = 0; ig < size; ++ig)
+						for (int ir = 0; ir < size; ++ir, q += 3)
+						{
+								float bgr[3] = { ib / (float)(size - 1), ig / (float)(size - 1), ir / (float)(size - 1) };
+								float y = 0.114f*bgr[0] + 0.587f*bgr[1] + 0.299f*bgr[2];
+								for (int c = 0; c < 3; ++c)
+								{
+										float v = y + 0.8f*(bgr[c] - y);        // desaturate
+										v = v*v*(3 - 2*v);                       // S-curve
+										v += (c == 2 ? 0.04f : c == 0 ? -0.04f : 0.f) * y; // warm highlights
+										q[c] = saturate_cast<uchar>(v * 255);
+								}
+						}
+		return lut;
+}
+
+// Trilinear interpolation in 8-bit fixed point. For every input value the cube
+// cell and the weight inside the cell are precomputed once, so the pixel loop
+// has no divisions. The cube is stored as bytes: 33^3 nodes are 108 KB and stay
+// in L2 while the image streams through, each pixel is read once and written once.
+void applyLut3D(const Mat& src, Mat& dst, const Lut3D& lut)
+{
+		CV_Assert(src.type() == CV_8UC3);
+		CV_Assert(lut.size >= 2 && lut.data.size() == (size_t)lut.size*lut.size*lut.size*3);
+
+		const int n = lut.size;
+		// cell[v]: index of the lower node, weight[v]: position inside the cell in [0, 256]
+		int cell[256], weight[256];
+		for (int v = 0; v < 256; ++v)
+		{
+				int pos = v * (n - 1);
+				cell[v] = pos / 255;
+				weight[v] = ((pos % 255) * 256 + 127) / 255;
+				if (cell[v] == n - 1)
+				{
+						// v == 255 sits on the last node, interpolate from the cell below it
+						cell[v] = n - 2;
+						weight[v] = 256;
+				}
+		}
+
+		dst.create(src.size(), src.type());
+
+		const uchar* cube = &lut.data[0];
+		const int strideR = 3, strideG = n*3, strideB = n*n*3;
+
+		parallel_for_(Range(0, src.rows), [&](const Range& range){
+				for (int i = range.start; i < range.end; i++)
+				{
+						const uchar* p = src.ptr<uchar>(i);
+						uchar* q = dst.ptr<uchar>(i);
+						for (int j = 0; j < src.cols; ++j, p += 3, q += 3)
+						{
+								const int wb = weight[p[0]], wg = weight[p[1]], wr = weight[p[2]];
+								const uchar* c000 = cube + cell[p[0]]*strideB + cell[p[1]]*strideG + cell[p[2]]*strideR;
+								const uchar* c010 = c000 + strideG;
+								const uchar* c100 = c000 + strideB;
+								const uchar* c110 = c100 + strideG;
+
+								uchar out[3];
+								for (int c = 0; c < 3; ++c)
+								{
+										// along r, then g (values scaled by 256), then b (scaled by 256^2)
+										int v00 = (c000[c] << 8) + (c000[c + strideR] - c000[c]) * wr;
+										int v01 = (c010[c] << 8) + (c010[c + strideR] - c010[c]) * wr;
+										int v10 = (c100[c] << 8) + (c100[c + strideR] - c100[c]) * wr;
+										int v11 = (c110[c] << 8) + (c110[c + strideR] - c110[c]) * wr;
+										int v0 = (v00 << 8) + (v01 - v00) * wg;
+										int v1 = (v10 << 8) + (v11 - v10) * wg;
+										int v = ((v0 >> 8) << 8) + ((v1 >> 8) - (v0 >> 8)) * wb;
+										out[c] = (uchar)((v + (1 << 15)) >> 16);
+								}
+								q[0] = out[0]; q[1] = out[1]; q[2] = out[2];
+						}
+				}
+		}, (double)src.total() * src.elemSize() / (1 << 16));
+}
+//! [scan-3d-lut]
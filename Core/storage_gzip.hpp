@@ -0,0 +1,553 @@
+/**
+ * @file storage_gzip.hpp
+ * @brief gzip files compressed and decompressed on several threads, block by block
+ *
+ *     FileStorage fs(".yml", FileStorage::WRITE | FileStorage::MEMORY);
+ *     fs << "features" << features;
+ *     storage::GzipWriter out;
+ *     out.open("features.yml.gz");
+ *     out.write(fs.releaseAndGetString());
+ *     out.release();
+ *
+ *     storage::GzipReader in;
+ *     in.open("features.yml.gz");
+ *     storage::StreamReader reader;
+ *     reader.open([&](char* b, size_t n){ return in.read(b, n); });   // parses while blocks inflate
+ *
+ * GzipWriter cuts its input into 1 MB blocks and compresses them on a pool
+ * of threads; the calling thread writes the results in order. Every block
+ * is a complete gzip member, and members one after the other are a valid
+ * gzip file (gunzip, zlib and FileStorage read it as one stream). Each
+ * member records its compressed size in the header's extra field, like
+ * BGZF, which costs a few bytes per block and no dictionary is shared
+ * between blocks, so the file is slightly larger than a single stream.
+ *
+ * GzipReader uses those sizes to find the next members without inflating
+ * them: blocks are decompressed on the pool, ahead of whoever reads them.
+ * Any other gzip file (one written by FileStorage for instance) is inflated
+ * by one background thread, which still runs ahead of the parser.
+ *
+ * Needs zlib (OpenCV builds with it; link with -lz).
+ */
+
+#ifndef CORE_STORAGE_GZIP_HPP
+#define CORE_STORAGE_GZIP_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+namespace storage
+{
+
+namespace detail
+{
+enum { GZIP_HEADER = 20, GZIP_TRAILER = 8 };   // a member's header with the size field, crc and size
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_DONE };
+
+// one block in flight: the input and the output of a worker
+struct GzipSlot
+{
+		std::vector<uchar> in, out;
+		size_t inBytes, outBytes;
+		int state;
+		std::string error;
+		GzipSlot() : inBytes(0), outBytes(0), state(SLOT_FREE) {}
+};
+
+inline void put32(uchar* p, unsigned v)
+{
+		p[0] = (uchar)v;
+		p[1] = (uchar)(v >> 8);
+		p[2] = (uchar)(v >> 16);
+		p[3] = (uchar)(v >> 24);
+}
+
+inline unsigned get32(const uchar* p)
+{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// gzip header with FEXTRA: subfield "CV", 4 bytes, the size of the whole member
+inline void memberHeader(uchar* p, size_t memberBytes)
+{
+		const uchar fixed[16] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255, 8, 0, 'C', 'V', 4, 0 };
+		std::memcpy(p, fixed, sizeof(fixed));
+		put32(p + 16, (unsigned)memberBytes);
+}
+
+// the member size from such a header, 0 if it is not one
+inline size_t memberBytes(const uchar* p)
+{
+		const uchar fixed[4] = { 0x1f, 0x8b, 8, 4 };
+		if (std::memcmp(p, fixed, 4) != 0 || p[10] != 8 || p[11] != 0 || p[12] != 'C' || p[13] != 'V'
+				|| p[14] != 4 || p[15] != 0)
+				return 0;
+		const size_t n = get32(p + 16);
+		return n >= GZIP_HEADER + GZIP_TRAILER ? n : 0;
+}
+
+// std::threads taking slot numbers from a queue
+class Workers
+{
+public:
+		Workers() : m_closed(false) {}
+		~Workers() { stop(); }
+
+		template<typename Job>
+		void start(int threads, Job job)
+		{
+				m_closed = false;
+				for (int i = 0; i < threads; ++i)
+						m_threads.push_back(std::thread([this, job]() mutable {
+								int slot;
+								while ((slot = pop()) >= 0)
+										job(slot);
+						}));
+		}
+
+		void push(int slot)
+		{
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						m_queue.push_back(slot);
+				}
+				m_ready.notify_one();
+		}
+
+		void stop()
+		{
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						m_closed = true;
+				}
+				m_ready.notify_all();
+				for (size_t i = 0; i < m_threads.size(); ++i)
+						m_threads[i].join();
+				m_threads.clear();
+				m_queue.clear();
+		}
+
+private:
+		int pop()
+		{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_ready.wait(lock, [this]{ return !m_queue.empty() || m_closed; });
+				if (m_queue.empty())
+						return -1;
+				const int slot = m_queue.front();
+				m_queue.pop_front();
+				return slot;
+		}
+
+		std::vector<std::thread> m_threads;
+		std::deque<int> m_queue;
+		bool m_closed;
+		std::mutex m_mutex;
+		std::condition_variable m_ready;
+};
+} // namespace detail
+
+class GzipWriter
+{
+public:
+		enum { BLOCK = 1 << 20 };
+
+		// threads <= 0: cv::getNumThreads(); level as for zlib, 1 (fast) .. 9 (small)
+		explicit GzipWriter(int threads = 0, int level = Z_DEFAULT_COMPRESSION, size_t blockSize = BLOCK)
+				: m_threads(threads > 0 ? threads : std::max(cv::getNumThreads(), 1)), m_level(level),
+					m_blockSize(blockSize), m_file(0), m_filling(0), m_written(0)
+		{
+				m_slots.resize(2 * m_threads + 1);
+		}
+
+		~GzipWriter() { release(); }
+
+		bool open(const std::string& path)
+		{
+				release();
+				m_file = std::fopen(path.c_str(), "wb");
+				if (!m_file)
+						return false;
+				m_filling = m_written = 0;
+				for (size_t i = 0; i < m_slots.size(); ++i)
+				{
+						m_slots[i].in.resize(m_blockSize);
+						m_slots[i].inBytes = 0;
+						m_slots[i].state = detail::SLOT_FREE;
+				}
+				const int level = m_level;
+				m_workers.start(m_threads, [this, level](int slot){
+						compress(m_slots[slot], level);
+				});
+				return true;
+		}
+
+		bool isOpened() const { return m_file != 0; }
+
+		void write(const char* data, size_t bytes)
+		{
+				CV_Assert(m_file);
+				while (bytes > 0)
+				{
+						detail::GzipSlot& slot = m_slots[m_filling % m_slots.size()];
+						const size_t n = std::min(bytes, m_blockSize - slot.inBytes);
+						std::memcpy(&slot.in[slot.inBytes], data, n);
+						slot.inBytes += n;
+						data += n;
+						bytes -= n;
+						if (slot.inBytes == m_blockSize)
+								submit();
+				}
+		}
+
+		void write(const std::string& s) { write(s.data(), s.size()); }
+
+		// compresses what is left, writes every block and closes the file
+		bool release()
+		{
+				if (!m_file)
+						return false;
+				if (m_slots[m_filling % m_slots.size()].inBytes > 0 || m_filling == 0)   // at least one member
+						submit();
+				while (m_written < m_filling)
+						writeOldest();
+				m_workers.stop();
+				const bool ok = m_error.empty() && std::ferror(m_file) == 0;
+				std::fclose(m_file);
+				m_file = 0;
+				m_error.clear();
+				return ok;
+		}
+
+private:
+		GzipWriter(const GzipWriter&);
+		GzipWriter& operator=(const GzipWriter&);
+
+		// queues the block being filled; the slot after it must be free to fill
+		void submit()
+		{
+				const int index = (int)(m_filling % m_slots.size());
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						m_slots[index].state = detail::SLOT_QUEUED;
+				}
+				m_workers.push(index);
+				++m_filling;
+				if (m_filling - m_written == m_slots.size())
+						writeOldest();
+		}
+
+		void writeOldest()
+		{
+				detail::GzipSlot& slot = m_slots[m_written % m_slots.size()];
+				{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_done.wait(lock, [&slot]{ return slot.state == detail::SLOT_DONE; });
+				}
+				if (!slot.error.empty())
+						m_error = slot.error;
+				else
+						std::fwrite(&slot.out[0], 1, slot.outBytes, m_file);
+				slot.inBytes = 0;
+				slot.state = detail::SLOT_FREE;
+				++m_written;
+		}
+
+		// on a worker: the slot's input as one gzip member
+		void compress(detail::GzipSlot& slot, int level)
+		{
+				z_stream z = z_stream();
+				slot.error.clear();
+				if (deflateInit2(&z, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+						slot.error = "storage::GzipWriter: deflateInit2 failed";
+				else
+				{
+						const size_t bound = deflateBound(&z, (uLong)slot.inBytes);
+						slot.out.resize(detail::GZIP_HEADER + bound + detail::GZIP_TRAILER);
+						z.next_in = slot.inBytes ? &slot.in[0] : 0;
+						z.avail_in = (uInt)slot.inBytes;
+						z.next_out = &slot.out[detail::GZIP_HEADER];
+						z.avail_out = (uInt)bound;
+						if (deflate(&z, Z_FINISH) != Z_STREAM_END)
+								slot.error = "storage::GzipWriter: deflate failed";
+						slot.outBytes = detail::GZIP_HEADER + z.total_out + detail::GZIP_TRAILER;
+						deflateEnd(&z);
+						uchar* trailer = &slot.out[detail::GZIP_HEADER + z.total_out];
+						detail::put32(trailer, (unsigned)crc32(0, slot.inBytes ? &slot.in[0] : 0, (uInt)slot.inBytes));
+						detail::put32(trailer + 4, (unsigned)slot.inBytes);
+						detail::memberHeader(&slot.out[0], slot.outBytes);
+				}
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						slot.state = detail::SLOT_DONE;
+				}
+				m_done.notify_all();
+		}
+
+		int m_threads, m_level;
+		size_t m_blockSize;
+		std::FILE* m_file;
+		std::vector<detail::GzipSlot> m_slots;   // a ring: block i is in slot i % size
+		size_t m_filling, m_written;             // blocks queued, blocks written to the file
+		std::string m_error;
+		std::mutex m_mutex;
+		std::condition_variable m_done;
+		detail::Workers m_workers;
+};
+
+class GzipReader
+{
+public:
+		explicit GzipReader(int threads = 0)
+				: m_threads(threads > 0 ? threads : std::max(cv::getNumThreads(), 1)), m_file(0), m_parallel(false),
+					m_next(0), m_scheduled(0), m_offset(0), m_reading(false), m_end(true), m_closing(false)
+		{
+				m_slots.resize(2 * m_threads + 2);
+		}
+
+		~GzipReader() { release(); }
+
+		bool open(const std::string& path)
+		{
+				release();
+				m_file = std::fopen(path.c_str(), "rb");
+				if (!m_file)
+						return false;
+				uchar header[detail::GZIP_HEADER];
+				const size_t n = std::fread(header, 1, sizeof(header), m_file);
+				if (n < 2 || header[0] != 0x1f || header[1] != 0x8b)
+				{
+						release();
+						return false;
+				}
+				std::rewind(m_file);
+				m_parallel = n == sizeof(header) && detail::memberBytes(header) != 0;
+				m_next = m_scheduled = m_offset = 0;
+				m_reading = m_end = m_closing = false;
+				for (size_t i = 0; i < m_slots.size(); ++i)
+						m_slots[i].state = detail::SLOT_FREE;
+				if (m_parallel)
+				{
+						m_workers.start(m_threads, [this](int slot){ inflateMember(m_slots[slot]); });
+						schedule();
+				}
+				else
+						m_inflater = std::thread([this]{ inflateStream(); });
+				return true;
+		}
+
+		bool isOpened() const { return m_file != 0; }
+
+		// true if the blocks are decompressed in parallel (a file from GzipWriter)
+		bool isParallel() const { return m_parallel; }
+
+		// the next decompressed bytes, up to bytes of them; 0 at the end
+		size_t read(char* buffer, size_t bytes)
+		{
+				size_t copied = 0;
+				while (copied < bytes && m_file)
+				{
+						detail::GzipSlot* slot = current();
+						if (!slot)
+								break;
+						const size_t n = std::min(bytes - copied, slot->outBytes - m_offset);
+						if (n)
+								std::memcpy(buffer + copied, &slot->out[m_offset], n);
+						copied += n;
+						m_offset += n;
+				}
+				return copied;
+		}
+
+		void release()
+		{
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						m_closing = true;
+				}
+				m_changed.notify_all();
+				if (m_inflater.joinable())
+						m_inflater.join();
+				m_workers.stop();
+				if (m_file)
+						std::fclose(m_file);
+				m_file = 0;
+		}
+
+private:
+		GzipReader(const GzipReader&);
+		GzipReader& operator=(const GzipReader&);
+
+		// the block being read, the next one once it is used up; 0 at the end
+		detail::GzipSlot* current()
+		{
+				if (m_reading && m_offset < m_slots[m_next % m_slots.size()].outBytes)
+						return &m_slots[m_next % m_slots.size()];
+				if (m_reading)
+				{
+						// used up: give it back
+						{
+								std::lock_guard<std::mutex> lock(m_mutex);
+								m_slots[m_next % m_slots.size()].state = detail::SLOT_FREE;
+								++m_next;
+								m_reading = false;
+						}
+						m_changed.notify_all();
+						m_offset = 0;
+						if (m_parallel)
+								schedule();
+				}
+				detail::GzipSlot& slot = m_slots[m_next % m_slots.size()];
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_changed.wait(lock, [this, &slot]{
+						return (m_next < m_scheduled && slot.state == detail::SLOT_DONE) || (m_end && m_next == m_scheduled);
+				});
+				if (m_next == m_scheduled)
+						return 0;
+				m_reading = true;
+				if (!slot.error.empty())
+						CV_Error(cv::Error::StsParseError, slot.error);
+				return &slot;
+		}
+
+		// on the reading thread: reads whole members into the free slots and queues them
+		void schedule()
+		{
+				while (!m_end && m_scheduled - m_next < m_slots.size())
+				{
+						detail::GzipSlot& slot = m_slots[m_scheduled % m_slots.size()];
+						uchar header[detail::GZIP_HEADER];
+						const size_t n = std::fread(header, 1, sizeof(header), m_file);
+						const size_t bytes = n == sizeof(header) ? detail::memberBytes(header) : 0;
+						if (bytes)
+						{
+								slot.in.resize(bytes);
+								std::memcpy(&slot.in[0], header, sizeof(header));
+								slot.inBytes = sizeof(header) + std::fread(&slot.in[sizeof(header)], 1, bytes - sizeof(header), m_file);
+						}
+						std::lock_guard<std::mutex> lock(m_mutex);
+						if (n == 0)
+						{
+								m_end = true;
+								break;
+						}
+						if (!bytes || slot.inBytes != bytes)
+								CV_Error(cv::Error::StsParseError, "storage::GzipReader: truncated file or a member without its size");
+						slot.state = detail::SLOT_QUEUED;
+						m_workers.push((int)(m_scheduled++ % m_slots.size()));
+				}
+				m_changed.notify_all();
+		}
+
+		// on a worker: one member of a GzipWriter file
+		void inflateMember(detail::GzipSlot& slot)
+		{
+				const uchar* trailer = &slot.in[slot.inBytes - detail::GZIP_TRAILER];
+				slot.outBytes = detail::get32(trailer + 4);
+				slot.out.resize(std::max(slot.outBytes, (size_t)1));
+				slot.error.clear();
+				z_stream z = z_stream();
+				if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+						slot.error = "storage::GzipReader: inflateInit2 failed";
+				else
+				{
+						z.next_in = &slot.in[detail::GZIP_HEADER];
+						z.avail_in = (uInt)(slot.inBytes - detail::GZIP_HEADER - detail::GZIP_TRAILER);
+						z.next_out = &slot.out[0];
+						z.avail_out = (uInt)slot.outBytes;
+						if (inflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out != slot.outBytes
+								|| crc32(0, &slot.out[0], (uInt)slot.outBytes) != detail::get32(trailer))
+								slot.error = "storage::GzipReader: corrupt block";
+						inflateEnd(&z);
+				}
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						slot.state = detail::SLOT_DONE;
+				}
+				m_changed.notify_all();
+		}
+
+		// on the background thread: any gzip file, member after member, into the slots in order
+		void inflateStream()
+		{
+				z_stream z = z_stream();
+				std::vector<uchar> input(1 << 16);
+				bool ok = inflateInit2(&z, MAX_WBITS + 16) == Z_OK, end = false, between = false;
+				while (!end)
+				{
+						detail::GzipSlot& slot = m_slots[m_scheduled % m_slots.size()];
+						{
+								std::unique_lock<std::mutex> lock(m_mutex);
+								m_changed.wait(lock, [this]{ return m_scheduled - m_next < m_slots.size() || m_closing; });
+								if (m_closing)
+										break;
+						}
+						slot.out.resize(GzipWriter::BLOCK);
+						slot.error.clear();
+						z.next_out = &slot.out[0];
+						z.avail_out = (uInt)slot.out.size();
+						while (ok && z.avail_out > 0)
+						{
+								if (z.avail_in == 0)
+								{
+										z.next_in = &input[0];
+										z.avail_in = (uInt)std::fread(&input[0], 1, input.size(), m_file);
+										if (z.avail_in == 0)
+										{
+												ok = between;   // else the file ends inside a member
+												end = true;
+												break;
+										}
+								}
+								const int r = inflate(&z, Z_NO_FLUSH);
+								between = r == Z_STREAM_END;
+								if (between)
+										ok = inflateReset(&z) == Z_OK;   // the next member, if there is one
+								else if (r != Z_OK)
+										ok = false;
+						}
+						if (!ok)
+						{
+								slot.error = "storage::GzipReader: corrupt gzip stream";
+								end = true;
+						}
+						slot.outBytes = slot.out.size() - z.avail_out;
+						std::lock_guard<std::mutex> lock(m_mutex);
+						if (slot.outBytes > 0 || !ok)
+						{
+								slot.state = detail::SLOT_DONE;
+								++m_scheduled;
+						}
+						m_end = end;
+						m_changed.notify_all();
+				}
+				inflateEnd(&z);
+		}
+
+		int m_threads;
+		std::FILE* m_file;
+		bool m_parallel;
+		std::vector<detail::GzipSlot> m_slots;   // a ring: block i is in slot i % size
+		size_t m_next, m_scheduled, m_offset;    // block being read, blocks queued, bytes read of m_next
+		bool m_reading;                          // m_next has been handed to read()
+		bool m_end, m_closing;
+		std::mutex m_mutex;
+		std::condition_variable m_changed;
+		detail::Workers m_workers;
+		std::thread m_inflater;
+};
+
+} // namespace storage
+
+#endif // CORE_STORAGE_GZIP_HPP
@@ -0,0 +1,346 @@
+/**
+ * @file storage_index.hpp
+ * @brief Offset index of the top-level nodes of a FileStorage file, for reading one node
+ *
+ *     storage::KeyIndex index("calib.yml");        // calib.yml.idx, built on first use
+ *     Mat R;
+ *     index.read("R", R);                           // parses the bytes of R only
+ *
+ *     FileStorage fs;
+ *     if (index.load("MyData", fs))                 // a FileStorage with nothing but MyData
+ *             fs["MyData"] >> m;
+ *
+ * FileStorage::READ parses the whole document before fs["R"] can be looked up.
+ * KeyIndex scans the file once for where each top-level node starts and ends
+ * (no values are parsed) and keeps these offsets in a small text file next to
+ * it, path + ".idx". Later opens read the sidecar; it is rebuilt when the size
+ * or the modification time of the file no longer match. load() reads the
+ * bytes of one node and gives them to FileStorage as a document of their own,
+ * so the cost is that of the node, not of the file.
+ *
+ * The scan follows the layout FileStorage writes: in YAML, top-level keys
+ * start a line at column 0 and everything else is indented or a sequence
+ * item; in XML, the children of the root element. Compressed files (.gz)
+ * cannot be read at an offset and are not indexed.
+ */
+
+#ifndef CORE_STORAGE_INDEX_HPP
+#define CORE_STORAGE_INDEX_HPP
+
+#include <opencv2/core.hpp>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "storage_stream.hpp"
+
+namespace storage
+{
+
+class KeyIndex
+{
+public:
+		struct Entry
+		{
+				std::string key;
+				size_t offset;   // first byte of the node, its key included
+				size_t bytes;
+		};
+
+		KeyIndex() : m_xml(false), m_fileBytes(0), m_modified(0) {}
+		explicit KeyIndex(const std::string& path, bool save = true)
+				: m_xml(false), m_fileBytes(0), m_modified(0)
+		{
+				open(path, save);
+		}
+
+		// The index of path: read from path + ".idx" when it is up to date,
+		// otherwise built by scanning the file and, if save, written there
+		bool open(const std::string& path, bool save = true)
+		{
+				if (loadSidecar(path))
+						return true;
+				if (!build(path))
+						return false;
+				// in a read-only directory the next open scans again
+				if (save)
+						this->save(path + ".idx");
+				return true;
+		}
+
+		// scans path, without reading or writing a sidecar
+		bool build(const std::string& path)
+		{
+				clear();
+				if (!stamp(path, m_fileBytes, m_modified) || isCompressed(path))
+						return false;
+				std::shared_ptr<std::ifstream> file(new std::ifstream(path.c_str(), std::ios::binary));
+				if (!*file)
+						return false;
+				m_input.reset([file](char* buffer, size_t bytes) -> size_t {
+						file->read(buffer, bytes);
+						return (size_t)file->gcount();
+				});
+				while (detail::isSpace(m_input.peek()))
+						m_input.get();
+				m_xml = m_input.peek() == '<';
+				m_path = path;
+				if (m_xml)
+						scanXml();
+				else
+						scanYaml();
+				m_input.reset(Source());   // closes the file
+				return true;
+		}
+
+		bool save(const std::string& indexPath) const
+		{
+				std::ofstream out(indexPath.c_str(), std::ios::binary);
+				out << "%opencv-storage-index 1 " << (m_xml ? "xml " : "yaml ") << m_fileBytes << ' ' << m_modified << '\n';
+				for (size_t i = 0; i < m_entries.size(); ++i)
+						out << m_entries[i].offset << ' ' << m_entries[i].bytes << ' ' << m_entries[i].key << '\n';
+				return (bool)out;
+		}
+
+		void clear()
+		{
+				m_path.clear();
+				m_entries.clear();
+				m_find.clear();
+				m_fileBytes = 0;
+				m_modified = 0;
+		}
+
+		bool isOpened() const { return !m_path.empty(); }
+		size_t size() const { return m_entries.size(); }
+		const Entry& entry(size_t i) const { return m_entries[i]; }   // in document order
+		bool has(const std::string& key) const { return m_find.count(key) > 0; }
+
+		// fs holds only the node key (fs[key]), read from its bytes in the file
+		bool load(const std::string& key, cv::FileStorage& fs) const
+		{
+				std::map<std::string, size_t>::const_iterator it = m_find.find(key);
+				if (it == m_find.end())
+						return false;
+				const Entry& e = m_entries[it->second];
+				std::ifstream file(m_path.c_str(), std::ios::binary);
+				std::string text(m_xml ? "<?xml version=\"1.0\"?>\n<opencv_storage>\n" : "%YAML:1.0\n---\n");
+				const size_t head = text.size();
+				text.resize(head + e.bytes);
+				if (!file.seekg((std::streamoff)e.offset) || !file.read(&text[head], (std::streamsize)e.bytes))
+						CV_Error(cv::Error::StsError, "storage::KeyIndex: " + m_path + " is shorter than its index");
+				text += m_xml ? "\n</opencv_storage>\n" : "\n";
+				return fs.open(text, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+		}
+
+		// fs[key] >> value through load(); false, value unchanged, if there is no such key
+		template<typename T> bool read(const std::string& key, T& value) const
+		{
+				cv::FileStorage fs;
+				if (!load(key, fs))
+						return false;
+				fs[key] >> value;
+				return true;
+		}
+
+private:
+		static bool stamp(const std::string& path, size_t& bytes, long long& modified)
+		{
+				struct stat st;
+				if (stat(path.c_str(), &st) != 0)
+						return false;
+				bytes = (size_t)st.st_size;
+				modified = (long long)st.st_mtime * 1000000000LL;
+#if defined(__linux__)
+				modified += st.st_mtim.tv_nsec;   // a file rewritten within the same second
+#endif
+				return true;
+		}
+
+		static bool isCompressed(const std::string& path)
+		{
+				return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+		}
+
+		bool loadSidecar(const std::string& path)
+		{
+				clear();
+				size_t fileBytes;
+				long long modified;
+				std::ifstream in((path + ".idx").c_str(), std::ios::binary);
+				if (!in || !stamp(path, fileBytes, modified))
+						return false;
+				std::string magic, format;
+				int version = 0;
+				in >> magic >> version >> format >> m_fileBytes >> m_modified;
+				if (!in || magic != "%opencv-storage-index" || version != 1 || (format != "xml" && format != "yaml")
+						|| m_fileBytes != fileBytes || m_modified != modified)
+				{
+						clear();
+						return false;
+				}
+				m_xml = format == "xml";
+				Entry e;
+				while (in >> e.offset >> e.bytes && in.get() == ' ' && std::getline(in, e.key))
+				{
+						if (e.offset + e.bytes > fileBytes)
+								break;
+						add(e);
+				}
+				if (!in.eof())
+				{
+						clear();
+						return false;
+				}
+				m_path = path;
+				return true;
+		}
+
+		void add(const Entry& e)
+		{
+				// a repeated key keeps its first node
+				if (m_find.insert(std::make_pair(e.key, m_entries.size())).second)
+						m_entries.push_back(e);
+		}
+
+		// the node being scanned ends before byte end, where the next one begins
+		void close(size_t end)
+		{
+				if (!m_open.key.empty())
+				{
+						m_open.bytes = end - m_open.offset;
+						add(m_open);
+						m_open.key.clear();
+				}
+		}
+
+		void skipLine()
+		{
+				int c;
+				while ((c = m_input.get()) >= 0 && c != '\n')
+						;
+		}
+
+		// Top-level keys are the lines that start with a name at column 0; blank,
+		// indented, "- " item, comment and directive lines belong to the node above
+		void scanYaml()
+		{
+				m_open.key.clear();
+				for (int c; (c = m_input.peek()) >= 0; )
+				{
+						const size_t start = m_input.offset();
+						if (detail::isSpace(c) || c == '-' || c == '#' || c == '%' || c == '.')
+						{
+								if (c == '-' && m_input.peek(1) == '-' && m_input.peek(2) == '-')
+										close(start);   // another document
+								skipLine();
+								continue;
+						}
+						std::string key;
+						const bool quoted = c == '"' || c == '\'';
+						if (quoted)
+								m_input.get();
+						while ((c = m_input.peek()) >= 0 && c != '\n' && (quoted ? c != '"' && c != '\''
+										: c != ':' || !(detail::isSpace(m_input.peek(1)) || m_input.peek(1) < 0)))
+								key += (char)m_input.get();
+						if (quoted && c >= 0 && c != '\n')
+								m_input.get();
+						if (!quoted)
+								detail::trimRight(key);
+						if (m_input.peek() == ':')
+						{
+								close(start);
+								m_open.key = key;
+								m_open.offset = start;
+						}
+						skipLine();
+				}
+				close(m_input.offset());
+		}
+
+		// skips up to and including the terminator of a comment, declaration or <?...?>
+		void skipTo(const char* end)
+		{
+				const size_t n = std::strlen(end);
+				std::string last;
+				for (int c; (c = m_input.get()) >= 0; )
+				{
+						last += (char)c;
+						if (last.size() > n)
+								last.erase(0, 1);
+						if (last == end)
+								break;
+				}
+		}
+
+		// The children of the root element, each from its '<' to the end of its
+		// closing tag. Text never holds a raw '<', so only tags are looked at.
+		void scanXml()
+		{
+				m_open.key.clear();
+				int depth = 0;
+				for (int c; (c = m_input.get()) >= 0; )
+				{
+						if (c != '<')
+								continue;
+						const size_t start = m_input.offset() - 1;
+						c = m_input.peek();
+						if (c == '?')
+						{
+								skipTo("?>");
+								continue;
+						}
+						if (c == '!')
+						{
+								skipTo(m_input.peek(1) == '-' ? "-->" : ">");
+								continue;
+						}
+						const bool closing = c == '/';
+						if (closing)
+								m_input.get();
+						std::string name;
+						while ((c = m_input.peek()) >= 0 && !detail::isSpace(c) && c != '>' && c != '/')
+								name += (char)m_input.get();
+						// to the end of the tag, attribute values may hold '>'
+						int quote = 0, last = 0;
+						while ((c = m_input.get()) >= 0 && (quote || c != '>'))
+						{
+								if (c == '"' || c == '\'')
+										quote = quote == c ? 0 : quote ? quote : c;
+								last = c;
+						}
+						const bool empty = !closing && last == '/';
+						if (closing)
+						{
+								if (--depth == 1)
+										close(m_input.offset());
+								continue;
+						}
+						if (depth == 1)
+						{
+								m_open.key = name;
+								m_open.offset = start;
+								if (empty)
+										close(m_input.offset());
+						}
+						if (!empty)
+								++depth;
+				}
+		}
+
+		std::string m_path;
+		bool m_xml;
+		size_t m_fileBytes;
+		long long m_modified;
+		std::vector<Entry> m_entries;
+		std::map<std::string, size_t> m_find;
+		detail::Input m_input;   // only while scanning
+		Entry m_open;            // the node being scanned
+};
+
+} // namespace storage
+
+#endif // CORE_STORAGE_INDEX_HPP
@@ -0,0 +1,182 @@
+/**
+ * @file storage_schema.hpp
+ * @brief Fields of a struct declared once, for reading FileStorage records without key lookups
+ *
+ *     storage::Schema<MyData> schema;
+ *     schema.field("A", &MyData::A).field("X", &MyData::X).field("id", &MyData::id);
+ *
+ *     std::vector<MyData> records;
+ *     schema.readSeq(fs["records"], records);      // a sequence of maps, into one vector
+ *
+ *     storage::Schema<MyData>::Reader reader = schema.reader();
+ *     for (FileNodeIterator it = n.begin(); it != n.end(); ++it)
+ *             reader.read(*it, m);                 // one record at a time
+ *
+ * A hand-written read() does node["A"], node["X"], node["id"]: every field of
+ * every record is a search through the keys of the record. A Reader matches
+ * the keys of the first record against the fields once and remembers which
+ * field each position holds. The next records are read by walking their
+ * entries in order and assigning each to its field through the remembered
+ * position: each key is compared once, with the key at its position in the
+ * layout, instead of being searched for among the fields.
+ *
+ * Records written by the same write() have the same keys in the same order.
+ * A record that does not (another entry count, or an entry whose key or node
+ * type is not the one seen before) is matched by key again, and that becomes
+ * the layout for the following records.
+ *
+ * Values are read with >>, so a field can be anything with a read() for
+ * FileNode, nested structs and Mats included; a field missing from a record
+ * gets the default of >> on an empty node, as node["A"] >> x.A would.
+ */
+
+#ifndef CORE_STORAGE_SCHEMA_HPP
+#define CORE_STORAGE_SCHEMA_HPP
+
+#include <opencv2/core.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace storage
+{
+
+template<typename T>
+class Schema
+{
+public:
+		// Reads member from the entry named key; returns *this to chain declarations
+		template<typename M> Schema& field(const std::string& key, M T::* member)
+		{
+				for (size_t i = 0; i < m_fields.size(); ++i)
+						if (m_fields[i].key == key)
+								CV_Error(cv::Error::StsBadArg, "storage::Schema: field " + key + " declared twice");
+				Field f;
+				f.key = key;
+				f.assign = [member](const cv::FileNode& node, T& x){ node >> (x.*member); };
+				m_fields.push_back(f);
+				return *this;
+		}
+
+		size_t size() const { return m_fields.size(); }
+
+		// Reads records that share their layout; keeps the key positions between calls
+		class Reader
+		{
+		public:
+				explicit Reader(const Schema& schema) : m_schema(&schema), m_entries(-1) {}
+
+				void read(const cv::FileNode& node, T& x)
+				{
+						if (!node.isMap())
+						{
+								x = T();   // as read(node, x, T()) does for an empty node
+								return;
+						}
+						if ((int)node.size() != m_entries)
+								match(node);
+						if (!assign(node, x))
+						{
+								match(node);
+								assign(node, x);
+						}
+						for (size_t i = 0; i < m_missing.size(); ++i)
+								m_schema->m_fields[m_missing[i]].assign(cv::FileNode(), x);
+				}
+
+		private:
+				// the field, the node type and the key at each position of node, by key
+				void match(const cv::FileNode& node)
+				{
+						const std::vector<Field>& fields = m_schema->m_fields;
+						std::vector<bool> found(fields.size(), false);
+						m_slots.clear();
+						for (cv::FileNodeIterator it = node.begin(), it_end = node.end(); it != it_end; ++it)
+						{
+								const cv::FileNode entry = *it;
+								const std::string name = entry.name();
+								Slot slot = { -1, entry.type(), name };
+								for (size_t f = 0; f < fields.size(); ++f)
+										if (!found[f] && fields[f].key == name)
+										{
+												slot.field = (int)f;
+												found[f] = true;
+												break;
+										}
+								m_slots.push_back(slot);
+						}
+						m_entries = (int)m_slots.size();
+						m_missing.clear();
+						for (size_t f = 0; f < fields.size(); ++f)
+								if (!found[f])
+										m_missing.push_back((int)f);
+				}
+
+				// false, x partly read, when an entry does not fit the layout; entries no
+				// field reads are checked too, one of them may now hold a field
+				bool assign(const cv::FileNode& node, T& x) const
+				{
+						const std::vector<Field>& fields = m_schema->m_fields;
+						const Slot* slot = m_slots.empty() ? 0 : &m_slots[0];
+						for (cv::FileNodeIterator it = node.begin(), it_end = node.end(); it != it_end; ++it, ++slot)
+						{
+								const cv::FileNode entry = *it;
+								const std::string name = entry.name();
+								if (entry.type() != slot->type || name != slot->key)
+										return false;
+								if (slot->field >= 0)
+										fields[slot->field].assign(entry, x);
+						}
+						return true;
+				}
+
+				struct Slot
+				{
+						int field;         // index in the schema, -1 for an entry no field reads
+						int type;          // FileNode::type() of the entry when matched
+						std::string key;
+				};
+
+				const Schema* m_schema;
+				int m_entries;                // entry count of the layout, -1 before the first record
+				std::vector<Slot> m_slots;
+				std::vector<int> m_missing;   // fields with no entry in the layout
+		};
+
+		Reader reader() const { return Reader(*this); }
+
+		// One record, matched by key
+		void read(const cv::FileNode& node, T& x) const
+		{
+				Reader(*this).read(node, x);
+		}
+
+		// A sequence of records into out, replacing its contents; the key
+		// positions are matched on the first record
+		void readSeq(const cv::FileNode& seq, std::vector<T>& out) const
+		{
+				out.clear();
+				if (seq.empty())
+						return;
+				if (!seq.isSeq())
+						CV_Error(cv::Error::StsBadArg, "storage::Schema: readSeq of a node that is not a sequence");
+				out.resize(seq.size());
+				Reader reader(*this);
+				T* x = out.empty() ? 0 : &out[0];
+				for (cv::FileNodeIterator it = seq.begin(), it_end = seq.end(); it != it_end; ++it)
+						reader.read(*it, *x++);
+		}
+
+private:
+		struct Field
+		{
+				std::string key;
+				std::function<void(const cv::FileNode&, T&)> assign;
+		};
+
+		std::vector<Field> m_fields;
+};
+
+} // namespace storage
+
+#endif // CORE_STORAGE_SCHEMA_HPP
@@ -0,0 +1,969 @@
+/**
+ * @file storage_stream.hpp
+ * @brief Pull reader for the YAML and XML files FileStorage writes, one node at a time
+ *
+ *     storage::StreamReader in("annotations.yml");
+ *     storage::Event e;
+ *     while (in.next(e))
+ *     {
+ *             if (e.type == storage::EVENT_SCALAR && e.key == "id")
+ *                     process(e.value);
+ *             else if (e.type == storage::EVENT_BEGIN_MAP && e.tag == "opencv-matrix")
+ *                     in.readMat(M);                   // the rest of the matrix node
+ *     }
+ *
+ * FileStorage::READ builds the node tree of the whole file before the first
+ * lookup. StreamReader reads the file through a 64 KB buffer and returns its
+ * nodes in document order: the begin and the end of every map and sequence
+ * and every scalar, with its key in the enclosing map. Memory stays the
+ * buffer plus the nesting depth, and the first record is there as soon as its
+ * bytes have been read.
+ *
+ * What is covered is what FileStorage writes: YAML block and flow
+ * collections, plain and quoted scalars, tags such as !!opencv-matrix; XML
+ * elements, <_> sequence items, type_id attributes and whitespace-separated
+ * values. The top-level map (opencv_storage in XML) is not reported: its
+ * entries have depth 0.
+ */
+
+#ifndef CORE_STORAGE_STREAM_HPP
+#define CORE_STORAGE_STREAM_HPP
+
+#include <opencv2/core.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace storage
+{
+
+enum EventType { EVENT_SCALAR = 0, EVENT_BEGIN_MAP = 1, EVENT_END_MAP = 2, EVENT_BEGIN_SEQ = 3, EVENT_END_SEQ = 4 };
+
+struct Event
+{
+		int type;
+		int depth;           // enclosing maps and sequences, the top-level map not counted
+		std::string key;     // name in the enclosing map; empty in a sequence and on END events
+		std::string value;   // EVENT_SCALAR: the text, without quotes and escapes
+		std::string tag;     // BEGIN events: "opencv-matrix" etc., from !!tag or type_id
+		bool quoted;         // EVENT_SCALAR: written as a string
+
+		Event() : type(EVENT_SCALAR), depth(0), quoted(false) {}
+
+		bool isBegin() const { return type == EVENT_BEGIN_MAP || type == EVENT_BEGIN_SEQ; }
+		bool isEnd() const { return type == EVENT_END_MAP || type == EVENT_END_SEQ; }
+
+		int toInt() const { return (int)std::strtol(value.c_str(), 0, 10); }
+
+		double toReal() const
+		{
+				// FileStorage's spelling of the special values
+				const char* s = value.c_str() + (value[0] == '+' || value[0] == '-');
+				if (std::strcmp(s, ".Inf") == 0 || std::strcmp(s, ".inf") == 0)
+						return value[0] == '-' ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+				if (std::strcmp(s, ".Nan") == 0 || std::strcmp(s, ".nan") == 0)
+						return std::numeric_limits<double>::quiet_NaN();
+				return std::strtod(value.c_str(), 0);
+		}
+};
+
+// fills the buffer with up to bytes bytes, returns how many; 0 at the end
+typedef std::function<size_t(char* buffer, size_t bytes)> Source;
+
+namespace detail
+{
+// characters from a Source through a fixed buffer, with a few of look-ahead
+class Input
+{
+public:
+		enum { BUFFER = 1 << 16 };
+
+		Input() : m_buffer(BUFFER), m_base(0), m_pos(0), m_end(0), m_line(1), m_column(0), m_eof(true) {}
+
+		void reset(const Source& source)
+		{
+				m_source = source;
+				m_base = m_pos = m_end = 0;
+				m_line = 1;
+				m_column = 0;
+				m_eof = false;
+		}
+
+		// the character ahead positions further, -1 past the end
+		int peek(size_t ahead = 0)
+		{
+				if (m_pos + ahead >= m_end && !fill(ahead))
+						return -1;
+				return (uchar)m_buffer[m_pos + ahead];
+		}
+
+		int get()
+		{
+				const int c = peek();
+				if (c >= 0)
+				{
+						++m_pos;
+						if (c == '\n')
+						{
+								++m_line;
+								m_column = 0;
+						}
+						else
+								++m_column;
+				}
+				return c;
+		}
+
+		int line() const { return m_line; }
+		int column() const { return m_column; }
+		size_t offset() const { return m_base + m_pos; }   // bytes read with get()
+
+private:
+		bool fill(size_t ahead)
+		{
+				m_base += m_pos;
+				std::memmove(&m_buffer[0], &m_buffer[m_pos], m_end - m_pos);
+				m_end -= m_pos;
+				m_pos = 0;
+				while (!m_eof && m_end <= ahead)
+				{
+						const size_t n = m_source(&m_buffer[m_end], m_buffer.size() - m_end);
+						m_eof = n == 0;
+						m_end += n;
+				}
+				return m_end > ahead;
+		}
+
+		Source m_source;
+		std::vector<char> m_buffer;
+		size_t m_base, m_pos, m_end;   // m_buffer[0] is byte m_base of the source
+		int m_line, m_column;
+		bool m_eof;
+};
+
+inline bool isBlank(int c) { return c == ' ' || c == '\t' || c == '\r'; }
+inline bool isLineEnd(int c) { return c < 0 || c == '\n' || c == '\r'; }
+inline bool isSpace(int c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+inline void trimRight(std::string& s)
+{
+		size_t n = s.size();
+		while (n > 0 && isBlank(s[n - 1]))
+				--n;
+		s.resize(n);
+}
+
+// "u", "3f", ... as FileStorage writes the dt of a matrix
+inline int parseType(const std::string& dt)
+{
+		char* s = (char*)dt.c_str();
+		int cn = 1;
+		if (*s >= '0' && *s <= '9')
+				cn = (int)std::strtol(s, &s, 10);
+		const char* depths = "ucwsifd";
+		const char* d = *s ? std::strchr(depths, *s) : 0;
+		if (!d || s[1] || cn < 1 || cn > 512)
+				CV_Error(cv::Error::StsParseError, "storage::StreamReader: unsupported matrix type " + dt);
+		return CV_MAKETYPE((int)(d - depths), cn);
+}
+} // namespace detail
+
+class StreamReader
+{
+public:
+		StreamReader() : m_format(FORMAT_NONE), m_done(true), m_head(0), m_size(0), m_depth(0), m_pending(false) {}
+		explicit StreamReader(const std::string& path)
+				: m_format(FORMAT_NONE), m_done(true), m_head(0), m_size(0), m_depth(0), m_pending(false)
+		{
+				open(path);
+		}
+
+		bool open(const std::string& path)
+		{
+				std::shared_ptr<std::ifstream> file(new std::ifstream(path.c_str(), std::ios::binary));
+				if (!*file)
+				{
+						m_format = FORMAT_NONE;
+						return false;
+				}
+				return open([file](char* buffer, size_t bytes) -> size_t {
+						file->read(buffer, bytes);
+						return (size_t)file->gcount();
+				});
+		}
+
+		// any byte source, e.g. a socket or a decompressor
+		bool open(const Source& source)
+		{
+				m_input.reset(source);
+				m_queue.clear();
+				m_head = m_size = 0;
+				m_depth = 0;
+				m_blocks.assign(1, Block(0, false));
+				m_flow.clear();
+				m_elements.clear();
+				m_pending = false;
+				m_done = false;
+				while (detail::isSpace(m_input.peek()))
+						m_input.get();
+				m_format = m_input.peek() == '<' ? FORMAT_XML : FORMAT_YAML;
+				return true;
+		}
+
+		bool isOpened() const { return m_format != FORMAT_NONE; }
+
+		// the next node in document order; false at the end of the document
+		bool next(Event& e)
+		{
+				while (m_head == m_size && !m_done)
+				{
+						m_head = m_size = 0;
+						if (m_format == FORMAT_XML)
+								xmlStep();
+						else
+								yamlStep();
+				}
+				if (m_head == m_size)
+						return false;
+				std::swap(e, m_queue[m_head++]);   // both keep their string buffers
+				return true;
+		}
+
+		// reads up to and including the end of the innermost open map or sequence
+		void skip()
+		{
+				Event& e = m_scratch;
+				for (int level = 1; level > 0 && next(e); )
+						level += e.isBegin() ? 1 : e.isEnd() ? -1 : 0;
+		}
+
+		// After an EVENT_BEGIN_MAP tagged "opencv-matrix": reads the rest of the
+		// node (rows, cols, dt, data) into m
+		void readMat(cv::Mat& m)
+		{
+				Event& e = m_scratch;
+				int rows = -1, cols = -1, type = -1, level = 1;
+				size_t n = 0, total = 0;
+				bool data = false;
+				while (level > 0 && next(e))
+				{
+						if (e.isEnd())
+						{
+								--level;
+								data = data && level > 1;
+								continue;
+						}
+						if (level == 1 && e.key == "data")
+						{
+								if (rows < 0 || cols < 0 || type < 0)
+										CV_Error(cv::Error::StsParseError, "storage::StreamReader: matrix data before its size");
+								m.create(rows, cols, type);
+								total = m.total() * m.channels();
+								data = true;
+						}
+						if (e.isBegin())
+								++level;
+						else if (data)
+						{
+								if (n == total)
+										CV_Error(cv::Error::StsParseError, "storage::StreamReader: too many matrix elements");
+								set(m, n++, e.toReal());
+								data = level > 1;   // a single element is a scalar, not a sequence
+						}
+						else if (level == 1 && e.key == "rows")
+								rows = e.toInt();
+						else if (level == 1 && e.key == "cols")
+								cols = e.toInt();
+						else if (level == 1 && e.key == "dt")
+								type = detail::parseType(e.value);
+				}
+				if (n != total || (total == 0 && rows * cols != 0))
+						CV_Error(cv::Error::StsParseError, "storage::StreamReader: matrix data does not match its size");
+		}
+
+private:
+		enum { FORMAT_NONE, FORMAT_YAML, FORMAT_XML };
+
+		static void set(cv::Mat& m, size_t i, double v)
+		{
+				uchar* p = m.ptr();
+				switch (m.depth())
+				{
+				case CV_8U: ((uchar*)p)[i] = cv::saturate_cast<uchar>(v); break;
+				case CV_8S: ((schar*)p)[i] = (schar)std::min(std::max(cvRound(v), -128), 127); break;
+				case CV_16U: ((ushort*)p)[i] = cv::saturate_cast<ushort>(v); break;
+				case CV_16S: ((short*)p)[i] = cv::saturate_cast<short>(v); break;
+				case CV_32S: ((int*)p)[i] = cvRound(v); break;
+				case CV_32F: ((float*)p)[i] = (float)v; break;
+				default: ((double*)p)[i] = v; break;
+				}
+		}
+
+		void error(const std::string& what) const
+		{
+				CV_Error(cv::Error::StsParseError, "storage::StreamReader: " + what + " at line "
+								 + std::to_string(m_input.line()));
+		}
+
+		// the next free event of the queue; the queue is only filled once it is empty
+		Event& push(int type, const std::string& key, const std::string& tag)
+		{
+				if (m_size == m_queue.size())
+						m_queue.resize(m_size + 1);
+				Event& e = m_queue[m_size++];
+				e.type = type;
+				e.key = key;
+				e.tag = tag;
+				e.value.clear();
+				e.quoted = false;
+				if (type == EVENT_END_MAP || type == EVENT_END_SEQ)
+						--m_depth;
+				e.depth = m_depth;
+				if (type == EVENT_BEGIN_MAP || type == EVENT_BEGIN_SEQ)
+						++m_depth;
+				return e;
+		}
+
+		void scalar(const std::string& key, const std::string& value, const std::string& tag, bool quoted)
+		{
+				Event& e = push(EVENT_SCALAR, key, tag);
+				e.value = value;
+				e.quoted = quoted;
+		}
+
+		//************* YAML *****************
+		struct Block
+		{
+				int indent;
+				bool seq;
+				Block(int i, bool s) : indent(i), seq(s) {}
+		};
+
+		struct Flow
+		{
+				char close;       // ']' or '}'
+				bool expectKey;   // in a map, before the next key
+				Flow(char c) : close(c), expectKey(c == '}') {}
+		};
+
+		bool startsWith(const char* s)
+		{
+				for (size_t i = 0; s[i]; ++i)
+						if (m_input.peek(i) != (uchar)s[i])
+								return false;
+				return true;
+		}
+
+		void skipBlanks()
+		{
+				while (detail::isBlank(m_input.peek()))
+						m_input.get();
+		}
+
+		void skipLine()
+		{
+				int c;
+				while ((c = m_input.get()) >= 0 && c != '\n')
+						;
+		}
+
+		// after a value: only a comment may follow on the line
+		void endLine()
+		{
+				skipBlanks();
+				const int c = m_input.peek();
+				if (c != '#' && !detail::isLineEnd(c))
+						error("unexpected characters after a value");
+				skipLine();
+		}
+
+		void endBlock()
+		{
+				const bool seq = m_blocks.back().seq;
+				m_blocks.pop_back();
+				push(seq ? EVENT_END_SEQ : EVENT_END_MAP, std::string(), std::string());
+		}
+
+		// one line of block context, or one token inside a flow collection
+		void yamlStep()
+		{
+				if (!m_flow.empty())
+				{
+						flowStep();
+						return;
+				}
+				int column;
+				for (;;)
+				{
+						column = 0;
+						while (m_input.peek() == ' ')
+						{
+								m_input.get();
+								++column;
+						}
+						const int c = m_input.peek();
+						const bool marker = column == 0 && (startsWith("---") || startsWith("..."))
+								&& (detail::isSpace(m_input.peek(3)) || m_input.peek(3) < 0);
+						if (c == '#' || c == '\n' || c == '\r' || marker || (column == 0 && c == '%'))
+								skipLine();
+						else if (c == '\t')
+								error("tab in indentation");
+						else
+								break;
+				}
+				const int c = m_input.peek();
+				if (c < 0)
+				{
+						if (m_pending)
+								scalar(m_pendingKey, std::string(), m_pendingTag, false);
+						m_pending = false;
+						while (m_blocks.size() > 1)
+								endBlock();
+						m_done = true;
+						return;
+				}
+
+				const bool dash = c == '-' && (detail::isSpace(m_input.peek(1)) || m_input.peek(1) < 0);
+				bool opened = false;
+				if (m_pending)
+				{
+						// "key:" or "-" with nothing after: a deeper line holds the node,
+						// a sequence may also sit at the indentation of its key
+						const Block& top = m_blocks.back();
+						m_pending = false;
+						if (column > top.indent || (column == top.indent && dash && !top.seq))
+						{
+								m_blocks.push_back(Block(column, dash));
+								push(dash ? EVENT_BEGIN_SEQ : EVENT_BEGIN_MAP, m_pendingKey, m_pendingTag);
+								opened = true;
+						}
+						else
+								scalar(m_pendingKey, std::string(), m_pendingTag, false);
+				}
+				if (!opened)
+				{
+						while (m_blocks.size() > 1 && (m_blocks.back().indent > column
+								|| (m_blocks.back().seq && m_blocks.back().indent == column && !dash)))
+								endBlock();
+						if (m_blocks.back().indent != column || m_blocks.back().seq != dash)
+								error("bad indentation");
+				}
+
+				if (dash)
+				{
+						m_input.get();
+						skipBlanks();
+						blockValue(std::string(), true);
+				}
+				else
+				{
+						std::string key;
+						readBlockKey(key);
+						blockValue(key, false);
+				}
+		}
+
+		void readBlockKey(std::string& key)
+		{
+				if (m_input.peek() == '"' || m_input.peek() == '\'')
+				{
+						readQuoted(key);
+						skipBlanks();
+				}
+				else
+				{
+						key.clear();
+						int c;
+						while ((c = m_input.peek()) != ':' || !(detail::isSpace(m_input.peek(1)) || m_input.peek(1) < 0))
+						{
+								if (detail::isLineEnd(c))
+										error("expected a key");
+								key += (char)m_input.get();
+						}
+						detail::trimRight(key);
+				}
+				if (m_input.get() != ':')
+						error("expected ':' after a key");
+		}
+
+		// the rest of a line after "key:" or "- "; in a sequence item "key: value"
+		// opens a map whose keys are aligned with this one
+		void blockValue(const std::string& key, bool item)
+		{
+				const int column = m_input.column();
+				skipBlanks();
+				std::string tag;
+				if (m_input.peek() == '!')
+				{
+						readTag(tag);
+						skipBlanks();
+				}
+				const int c = m_input.peek();
+				if (c == '#' || detail::isLineEnd(c))
+				{
+						skipLine();
+						m_pending = true;
+						m_pendingKey = key;
+						m_pendingTag = tag;
+						return;
+				}
+				if (c == '[' || c == '{')
+				{
+						m_input.get();
+						push(c == '[' ? EVENT_BEGIN_SEQ : EVENT_BEGIN_MAP, key, tag);
+						m_flow.push_back(Flow(c == '[' ? ']' : '}'));
+						return;
+				}
+				if (c == '"' || c == '\'')
+				{
+						readQuoted(m_value);
+						skipBlanks();
+						if (item && m_input.peek() == ':')
+						{
+								m_input.get();
+								openItemMap(column, tag);
+								std::string inner;
+								inner.swap(m_value);
+								blockValue(inner, false);
+								return;
+						}
+						endLine();
+						scalar(key, m_value, tag, true);
+						return;
+				}
+
+				// plain scalar up to the end of the line or a comment
+				m_value.clear();
+				int d;
+				while (!detail::isLineEnd(d = m_input.peek()))
+				{
+						if (d == '#' && !m_value.empty() && detail::isBlank(m_value[m_value.size() - 1]))
+								break;
+						if (item && d == ':' && (detail::isSpace(m_input.peek(1)) || m_input.peek(1) < 0))
+						{
+								m_input.get();
+								detail::trimRight(m_value);
+								openItemMap(column, tag);
+								std::string inner;
+								inner.swap(m_value);
+								blockValue(inner, false);
+								return;
+						}
+						m_value += (char)m_input.get();
+				}
+				detail::trimRight(m_value);
+				skipLine();
+				scalar(key, m_value, tag, false);
+		}
+
+		void openItemMap(int column, const std::string& tag)
+		{
+				m_blocks.push_back(Block(column, false));
+				push(EVENT_BEGIN_MAP, std::string(), tag);
+		}
+
+		void skipFlowSpace()
+		{
+				for (;;)
+				{
+						const int c = m_input.peek();
+						if (c == '#')
+								skipLine();
+						else if (detail::isSpace(c))
+								m_input.get();
+						else
+								return;
+				}
+		}
+
+		void flowStep()
+		{
+				skipFlowSpace();
+				const int c = m_input.peek();
+				if (c < 0)
+						error("unterminated flow collection");
+				if (c == ']' || c == '}')
+				{
+						if (c != m_flow.back().close)
+								error("mismatched bracket");
+						m_input.get();
+						m_flow.pop_back();
+						push(c == ']' ? EVENT_END_SEQ : EVENT_END_MAP, std::string(), std::string());
+						if (m_flow.empty())
+								endLine();
+						return;
+				}
+				if (c == ',')
+				{
+						m_input.get();
+						m_flow.back().expectKey = m_flow.back().close == '}';
+						return;
+				}
+
+				std::string key;
+				if (m_flow.back().close == '}')
+				{
+						if (!m_flow.back().expectKey)
+								error("expected ',' in a flow map");
+						if (c == '"' || c == '\'')
+								readQuoted(key);
+						else
+								readFlowPlain(key, true);
+						skipFlowSpace();
+						if (m_input.get() != ':')
+								error("expected ':' after a key");
+						skipFlowSpace();
+						m_flow.back().expectKey = false;
+				}
+				std::string tag;
+				if (m_input.peek() == '!')
+				{
+						readTag(tag);
+						skipFlowSpace();
+				}
+				const int v = m_input.peek();
+				if (v == '[' || v == '{')
+				{
+						m_input.get();
+						push(v == '[' ? EVENT_BEGIN_SEQ : EVENT_BEGIN_MAP, key, tag);
+						m_flow.push_back(Flow(v == '[' ? ']' : '}'));
+						return;
+				}
+				const bool quoted = v == '"' || v == '\'';
+				if (quoted)
+						readQuoted(m_value);
+				else
+						readFlowPlain(m_value, false);
+				scalar(key, m_value, tag, quoted);
+		}
+
+		void readFlowPlain(std::string& s, bool key)
+		{
+				s.clear();
+				int c;
+				while ((c = m_input.peek()) >= 0 && c != ',' && c != ']' && c != '}' && c != '\n'
+							 && !(key && c == ':') && !(c == '#' && !s.empty() && detail::isBlank(s[s.size() - 1])))
+						s += (char)m_input.get();
+				detail::trimRight(s);
+		}
+
+		void readQuoted(std::string& s)
+		{
+				const int q = m_input.get();
+				s.clear();
+				for (;;)
+				{
+						int c = m_input.get();
+						if (c < 0)
+								error("unterminated string");
+						if (c == q)
+						{
+								if (q == '\'' && m_input.peek() == '\'')
+										c = m_input.get();
+								else
+										break;
+						}
+						else if (q == '"' && c == '\\')
+						{
+								c = m_input.get();
+								switch (c)
+								{
+								case 'n': c = '\n'; break;
+								case 't': c = '\t'; break;
+								case 'r': c = '\r'; break;
+								case '0': c = 0; break;
+								case 'x':
+								{
+										const char hex[3] = { (char)m_input.get(), (char)m_input.get(), 0 };
+										c = (int)std::strtol(hex, 0, 16);
+										break;
+								}
+								default: break;   // \" \\ \/
+								}
+						}
+						s += (char)c;
+				}
+		}
+
+		// !!opencv-matrix, !<tag:yaml.org,2002:opencv-matrix> -> opencv-matrix
+		void readTag(std::string& tag)
+		{
+				tag.clear();
+				while (!detail::isSpace(m_input.peek()) && m_input.peek() >= 0)
+						tag += (char)m_input.get();
+				size_t from = tag.find_last_of("!:");
+				tag = tag.substr(from == std::string::npos ? 0 : from + 1);
+				if (!tag.empty() && tag[tag.size() - 1] == '>')
+						tag.resize(tag.size() - 1);
+		}
+
+		//************* XML *****************
+		enum { ELEMENT_OPEN, ELEMENT_MAP, ELEMENT_SEQ, ELEMENT_TEXT_SEQ };
+
+		struct Element
+		{
+				std::string name, key, tag;
+				int state;   // ELEMENT_OPEN until the first child says map or sequence
+		};
+
+		void skipXmlSpace()
+		{
+				while (detail::isSpace(m_input.peek()))
+						m_input.get();
+		}
+
+		void skipPast(const char* end)
+		{
+				while (m_input.peek() >= 0 && !startsWith(end))
+						m_input.get();
+				for (size_t i = 0; end[i]; ++i)
+						m_input.get();
+		}
+
+		void expect(int c)
+		{
+				if (m_input.get() != c)
+						error(std::string("expected '") + (char)c + "'");
+		}
+
+		void readName(std::string& name)
+		{
+				name.clear();
+				int c;
+				while ((c = m_input.peek()) >= 0 && !detail::isSpace(c) && c != '>' && c != '/' && c != '=')
+						name += (char)m_input.get();
+				if (name.empty())
+						error("expected a name");
+		}
+
+		void closeTag(const std::string& name)
+		{
+				expect('<');
+				expect('/');
+				readName(m_name);
+				if (m_name != name)
+						error("</" + m_name + "> closes <" + name + ">");
+				skipXmlSpace();
+				expect('>');
+		}
+
+		// attributes up to the end of a start tag; true for an empty element "/>"
+		bool readAttributes(std::string& tag)
+		{
+				tag.clear();
+				for (;;)
+				{
+						skipXmlSpace();
+						const int c = m_input.get();
+						if (c == '>')
+								return false;
+						if (c == '/')
+						{
+								expect('>');
+								return true;
+						}
+						if (c < 0)
+								error("unterminated tag");
+						std::string name(1, (char)c), value;
+						while (!detail::isSpace(m_input.peek()) && m_input.peek() != '=' && m_input.peek() >= 0)
+								name += (char)m_input.get();
+						skipXmlSpace();
+						expect('=');
+						skipXmlSpace();
+						const int q = m_input.get();
+						if (q != '"' && q != '\'')
+								error("expected a quoted attribute value");
+						while (m_input.peek() != q && m_input.peek() >= 0)
+								appendXmlChar(value);
+						m_input.get();
+						if (name == "type_id")
+								tag = value;
+				}
+		}
+
+		// one character of text, with &lt; &#10; etc. decoded
+		void appendXmlChar(std::string& s)
+		{
+				const int c = m_input.get();
+				if (c != '&')
+				{
+						s += (char)c;
+						return;
+				}
+				std::string entity;
+				while (m_input.peek() != ';' && m_input.peek() >= 0 && entity.size() < 8)
+						entity += (char)m_input.get();
+				if (m_input.get() != ';')
+						error("bad entity");
+				if (entity == "lt") s += '<';
+				else if (entity == "gt") s += '>';
+				else if (entity == "amp") s += '&';
+				else if (entity == "quot") s += '"';
+				else if (entity == "apos") s += '\'';
+				else if (entity.size() > 1 && entity[0] == '#')
+						s += (char)std::strtol(entity.c_str() + 1 + (entity[1] == 'x'), 0, entity[1] == 'x' ? 16 : 10);
+				else
+						error("unknown entity &" + entity + ";");
+		}
+
+		// one whitespace-separated value, "quoted" if it holds spaces; true if quoted
+		bool readXmlToken(std::string& s)
+		{
+				s.clear();
+				if (m_input.peek() != '"')
+				{
+						while (!detail::isSpace(m_input.peek()) && m_input.peek() != '<' && m_input.peek() >= 0)
+								appendXmlChar(s);
+						return false;
+				}
+				m_input.get();
+				while (m_input.peek() != '"')
+				{
+						if (m_input.peek() < 0)
+								error("unterminated string");
+						if (m_input.peek() == '\\')
+								m_input.get();
+						appendXmlChar(s);
+				}
+				m_input.get();
+				return true;
+		}
+
+		// one tag, or one value of a whitespace-separated sequence
+		void xmlStep()
+		{
+				if (!m_elements.empty() && m_elements.back().state == ELEMENT_TEXT_SEQ)
+				{
+						skipXmlSpace();
+						if (m_input.peek() == '<')
+						{
+								closeTag(m_elements.back().name);
+								m_elements.pop_back();
+								push(EVENT_END_SEQ, std::string(), std::string());
+								return;
+						}
+						const bool quoted = readXmlToken(m_value);
+						scalar(std::string(), m_value, std::string(), quoted);
+						return;
+				}
+
+				skipXmlSpace();
+				const int c = m_input.get();
+				if (c < 0)
+				{
+						if (!m_elements.empty())
+								error("unexpected end of file");
+						m_done = true;
+						return;
+				}
+				if (c != '<')
+						error("unexpected text");
+				if (m_input.peek() == '?')
+				{
+						skipPast("?>");
+						return;
+				}
+				if (m_input.peek() == '!')
+				{
+						skipPast(startsWith("!--") ? "-->" : ">");
+						return;
+				}
+				if (m_input.peek() == '/')
+				{
+						m_input.get();
+						readName(m_name);
+						skipXmlSpace();
+						expect('>');
+						if (m_elements.empty() || m_elements.back().name != m_name)
+								error("unexpected </" + m_name + ">");
+						const Element& top = m_elements.back();
+						if (m_elements.size() == 1)
+								m_done = true;   // the end of opencv_storage
+						else if (top.state == ELEMENT_OPEN)
+								scalar(top.key, std::string(), top.tag, false);
+						else
+								push(top.state == ELEMENT_SEQ ? EVENT_END_SEQ : EVENT_END_MAP, std::string(), std::string());
+						m_elements.pop_back();
+						return;
+				}
+
+				Element element;
+				readName(element.name);
+				const bool empty = readAttributes(element.tag);
+				element.state = ELEMENT_OPEN;
+				if (m_elements.empty())
+				{
+						// opencv_storage: its entries are the top level
+						element.state = ELEMENT_MAP;
+						if (empty)
+								m_done = true;
+						else
+								m_elements.push_back(element);
+						return;
+				}
+				Element& parent = m_elements.back();
+				if (parent.state == ELEMENT_OPEN)
+				{
+						parent.state = element.name == "_" ? ELEMENT_SEQ : ELEMENT_MAP;
+						push(parent.state == ELEMENT_SEQ ? EVENT_BEGIN_SEQ : EVENT_BEGIN_MAP, parent.key, parent.tag);
+				}
+				if (parent.state != ELEMENT_SEQ)
+						element.key = element.name;
+				if (empty)
+				{
+						scalar(element.key, std::string(), element.tag, false);
+						return;
+				}
+
+				skipXmlSpace();
+				if (m_input.peek() == '<' && m_input.peek(1) != '/')
+				{
+						m_elements.push_back(element);   // child elements follow
+						return;
+				}
+				if (m_input.peek() == '<')
+				{
+						closeTag(element.name);
+						scalar(element.key, std::string(), element.tag, false);
+						return;
+				}
+				const bool quoted = readXmlToken(m_value);
+				skipXmlSpace();
+				if (m_input.peek() == '<')
+				{
+						closeTag(element.name);
+						scalar(element.key, m_value, element.tag, quoted);
+						return;
+				}
+				// more than one value: a sequence
+				push(EVENT_BEGIN_SEQ, element.key, element.tag);
+				scalar(std::string(), m_value, std::string(), quoted);
+				element.state = ELEMENT_TEXT_SEQ;
+				m_elements.push_back(element);
+		}
+
+		detail::Input m_input;
+		int m_format;
+		bool m_done;
+		std::vector<Event> m_queue;   // events of the last step, m_head is the next one
+		size_t m_head, m_size;
+		int m_depth;
+		Event m_scratch;
+		std::string m_value, m_name;
+
+		std::vector<Block> m_blocks;   // YAML: open block collections, [0] is the document
+		std::vector<Flow> m_flow;      // YAML: open [ ] and { }
+		bool m_pending;                // YAML: "key:" or "-" waiting for the next line
+		std::string m_pendingKey, m_pendingTag;
+
+		std::vector<Element> m_elements;   // XML: open elements, [0] is opencv_storage
+};
+
+} // namespace storage
+
+#endif // CORE_STORAGE_STREAM_HPP
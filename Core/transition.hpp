@@ -0,0 +1,277 @@
+/**
+ * @file transition.hpp
+ * @brief Cross-fade from one clip to another, streamed through a pool of frame buffers
+ *
+ *     transition::CrossFade fade(300, transition::EASE_SMOOTH);
+ *     transition::Stats s = fade.run(
+ *             [&](Mat& f){ return clipA.read(f); },      // decode into f
+ *             [&](Mat& f){ return clipB.read(f); },
+ *             [&](const Mat& f){ writer.write(f); });    // encode
+ *     cout << s.fps << " frames/s" << endl;
+ *
+ * Three stages run at the same time on different frames: a decode thread
+ * reads both clips, the calling thread blends (the rows split over the
+ * OpenCV threads) and an encode thread hands the result to the sink.
+ * Frames go through a fixed pool of slots, each holding the two inputs
+ * and the output, so once every slot has been used no buffer is
+ * allocated any more (as long as the sources decode into the Mat they
+ * are given, like VideoCapture::read). The weight of every frame is
+ * computed before the first one. An exception thrown by a source, the sink
+ * or the blend stops the three stages and is rethrown by run().
+ */
+
+#ifndef CORE_TRANSITION_HPP
+#define CORE_TRANSITION_HPP
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace transition
+{
+
+typedef std::function<bool(cv::Mat&)> Source;      // next frame into the Mat, false at the end
+typedef std::function<void(const cv::Mat&)> Sink;
+
+enum Easing { EASE_LINEAR = 0, EASE_SMOOTH = 1 };
+
+// weight of the second clip for each frame in 1/256: 0 on the first frame,
+// 256 on the last; EASE_SMOOTH starts and ends slowly (smoothstep)
+inline std::vector<int> schedule(int frames, int easing = EASE_LINEAR)
+{
+		CV_Assert(frames > 0);
+		std::vector<int> w(frames);
+		for (int i = 0; i < frames; ++i)
+		{
+				double t = frames > 1 ? (double)i / (frames - 1) : 1.0;
+				if (easing == EASE_SMOOTH)
+						t = t * t * (3 - 2 * t);
+				w[i] = cvRound(t * 256);
+		}
+		return w;
+}
+
+// dst = (a * (256 - w) + b * w) / 256 rounded, 8-bit, rows over the threads.
+// dst must already have the size and type of a and b.
+inline void crossFade(const cv::Mat& a, const cv::Mat& b, int w, cv::Mat& dst)
+{
+		CV_Assert(a.depth() == CV_8U && a.size() == b.size() && a.type() == b.type());
+		CV_Assert(dst.size() == a.size() && dst.type() == a.type());
+		const int n = a.cols * a.channels(), wa = 256 - w;
+		cv::parallel_for_(cv::Range(0, a.rows), [&](const cv::Range& range){
+				for (int i = range.start; i < range.end; ++i)
+				{
+						const uchar* p = a.ptr<uchar>(i);
+						const uchar* q = b.ptr<uchar>(i);
+						uchar* out = dst.ptr<uchar>(i);
+						// 16-bit products, vectorized by the compiler
+						for (int j = 0; j < n; ++j)
+								out[j] = (uchar)((p[j] * wa + q[j] * w + 128) >> 8);
+				}
+		}, (double)a.total() * a.elemSize() / (1 << 16));
+}
+
+struct Stats
+{
+		int frames;          // frames written to the sink
+		double seconds;      // wall time of run()
+		double fps;
+		size_t allocations;  // frame buffers (re)allocated since construction, pool warm-up included
+};
+
+class CrossFade
+{
+public:
+		CrossFade(int frames, int easing = EASE_LINEAR, int poolSize = 4)
+				: m_weights(schedule(frames, easing)), m_slots(std::max(poolSize, 2)),
+					m_free(m_slots.size()), m_decoded(m_slots.size()), m_blended(m_slots.size()),
+					m_allocations(0)
+		{}
+
+		const std::vector<int>& weights() const { return m_weights; }
+
+		// Streams the transition: frame i of from and to blended with weights()[i],
+		// until the schedule or one of the clips ends.
+		Stats run(const Source& from, const Source& to, const Sink& sink)
+		{
+				const int64 start = cv::getTickCount();
+				m_free.reset();
+				m_decoded.reset();
+				m_blended.reset();
+				for (size_t s = 0; s < m_slots.size(); ++s)
+						m_free.push((int)s);
+
+				// the first exception of any stage; closing m_free stops the decoder
+				std::mutex errorMutex;
+				std::exception_ptr error;
+				const auto fail = [&]{
+						{
+								std::lock_guard<std::mutex> lock(errorMutex);
+								if (!error)
+										error = std::current_exception();
+						}
+						m_free.close();
+				};
+
+				std::thread decoder([&]{
+						try
+						{
+								for (int i = 0; i < (int)m_weights.size(); ++i)
+								{
+										const int s = m_free.pop();
+										if (s < 0)
+												break;
+										Slot& slot = m_slots[s];
+										if (!from(slot.a) || !to(slot.b))
+												break;
+										slot.frame = i;
+										m_decoded.push(s);
+								}
+						}
+						catch (...)
+						{
+								fail();
+						}
+						m_decoded.close();
+				});
+
+				int frames = 0;
+				std::thread encoder([&]{
+						try
+						{
+								int s;
+								while ((s = m_blended.pop()) >= 0)
+								{
+										sink(m_slots[s].out);
+										++frames;
+										m_free.push(s);
+								}
+						}
+						catch (...)
+						{
+								fail();
+						}
+				});
+
+				try
+				{
+						int s;
+						while ((s = m_decoded.pop()) >= 0)
+						{
+								Slot& slot = m_slots[s];
+								slot.out.create(slot.a.size(), slot.a.type());
+								track(slot);
+								crossFade(slot.a, slot.b, m_weights[slot.frame], slot.out);
+								m_blended.push(s);
+						}
+				}
+				catch (...)
+				{
+						fail();
+				}
+				m_blended.close();
+				// the decoder may wait for a free slot after the last frame: let it go
+				m_free.close();
+				decoder.join();
+				encoder.join();
+				if (error)
+						std::rethrow_exception(error);
+
+				Stats stats;
+				stats.frames = frames;
+				stats.seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+				stats.fps = stats.seconds > 0 ? frames / stats.seconds : 0;
+				stats.allocations = m_allocations;
+				return stats;
+		}
+
+private:
+		struct Slot
+		{
+				cv::Mat a, b, out;
+				int frame;
+				const uchar* data[3];   // to notice reallocations
+				Slot() : frame(0) { data[0] = data[1] = data[2] = 0; }
+		};
+
+		// Slot numbers waiting for the next stage: a ring as large as the pool,
+		// so pushing never allocates. pop() returns -1 once closed and empty.
+		class SlotQueue
+		{
+		public:
+				explicit SlotQueue(size_t capacity) : m_ring(capacity), m_head(0), m_size(0), m_closed(false)
+				{}
+
+				void reset()
+				{
+						std::lock_guard<std::mutex> lock(m_mutex);
+						m_head = m_size = 0;
+						m_closed = false;
+				}
+
+				void push(int slot)
+				{
+						{
+								std::lock_guard<std::mutex> lock(m_mutex);
+								m_ring[(m_head + m_size) % m_ring.size()] = slot;
+								++m_size;
+						}
+						m_ready.notify_one();
+				}
+
+				int pop()
+				{
+						std::unique_lock<std::mutex> lock(m_mutex);
+						m_ready.wait(lock, [this]{ return m_size > 0 || m_closed; });
+						if (m_size == 0)
+								return -1;
+						const int slot = m_ring[m_head];
+						m_head = (m_head + 1) % m_ring.size();
+						--m_size;
+						return slot;
+				}
+
+				void close()
+				{
+						{
+								std::lock_guard<std::mutex> lock(m_mutex);
+								m_closed = true;
+						}
+						m_ready.notify_all();
+				}
+
+		private:
+				std::vector<int> m_ring;
+				size_t m_head, m_size;
+				bool m_closed;
+				std::mutex m_mutex;
+				std::condition_variable m_ready;
+		};
+
+		void track(Slot& slot)
+		{
+				const cv::Mat* m[3] = { &slot.a, &slot.b, &slot.out };
+				for (int i = 0; i < 3; ++i)
+						if (m[i]->data && m[i]->data != slot.data[i])
+						{
+								slot.data[i] = m[i]->data;
+								++m_allocations;
+						}
+		}
+
+		std::vector<int> m_weights;
+		std::vector<Slot> m_slots;
+		SlotQueue m_free, m_decoded, m_blended;
+		size_t m_allocations;
+};
+
+} // namespace transition
+
+#endif // CORE_TRANSITION_HPP
@@ -13,6 +13,7 @@
 #include "opencv2/imgproc.hpp"
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
+#include "../Core/stencil.hpp"
 
 using namespace std;
 using namespace cv;
@@ -68,7 +69,8 @@ int main( int argc, char ** argv )
 		//![blur]
 		for ( int i = 1; i < MAX_KERNEL_LENGTH; i = i + 2 )
 		{
-				blur( src, dst, Size( i, i ), Point(-1,-1) );
+				// blur( src, dst, Size( i, i ), Point(-1,-1) ) with the box built at compile time
+				stencil::blur( src, dst, i );
 				if( display_dst( DELAY_BLUR ) != 0 )
 				{
 						return 0;
@@ -85,7 +87,8 @@ int main( int argc, char ** argv )
 		//![gaussianblur]
 		for ( int i = 1; i < MAX_KERNEL_LENGTH; i = i + 2 )
 		{
-				GaussianBlur( src, dst, Size( i, i ), 0, 0 );
+				// about GaussianBlur( src, dst, Size( i, i ), 0, 0 ): the taps of getGaussianKernel( i, 0 ) built in
+				stencil::gaussianBlur( src, dst, i );
 				if( display_dst( DELAY_BLUR ) != 0 )
 				{
 						return 0;
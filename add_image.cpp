@@ -5,7 +5,16 @@
  */
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/highgui.hpp"
+#include "opencv2/imgproc.hpp"
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "Core/benchmark.hpp"
+#include "Core/blend.hpp"
+#include "Core/transition.hpp"
 
 using namespace cv;
 
@@ -14,12 +23,22 @@ using std::cin;
 using std::cout;
 using std::endl;
 
+static int benchmarkBlend();
+static int crossFadeStream( int frames );
+
 /**
  * @function main
  * @brief Main function
  */
-int main( void )
+int main( int argc, char** argv )
 {
+	 // --bench: N-way blend::blend against chained addWeighted
+	 if( argc >= 2 && !strcmp( argv[1], "--bench" ) )
+		 { return benchmarkBlend(); }
+	 // --transition [frames]: a 1080p cross-fade from one logo clip to the other, in frames/s
+	 if( argc >= 2 && !strcmp( argv[1], "--transition" ) )
+		 { return crossFadeStream( argc >= 3 ? atoi( argv[2] ) : 300 ); }
+
 	 double alpha = 0.5; double beta; double input;
 
 	 // source1 source2 destination
@@ -49,7 +68,12 @@ int main( void )
 	 // core function
 	 // addWeighted provides dst=α⋅src1+β⋅src2+γ
 	 // gamma = 0.0
-	 addWeighted( src1, alpha, src2, beta, 0.0, dst);
+	 // addWeighted( src1, alpha, src2, beta, 0.0, dst);
+	 // the same in fixed point, and any number of layers
+	 std::vector<blend::Layer> layers;
+	 layers.push_back( blend::Layer( src1, alpha ) );
+	 layers.push_back( blend::Layer( src2, beta ) );
+	 blend::blend( layers, dst );
 	 //![blend_images]
 
 	 //![display]
@@ -59,3 +83,141 @@ int main( void )
 
 	 return 0;
 }
+
+/**
+ * @function benchmarkBlend
+ * @brief 1080p BGR stacks of 2 to 16 layers: addWeighted over and over against one blend::blend,
+ *        then the same stacks with masks and as premultiplied BGRA
+ */
+static int benchmarkBlend()
+{
+	 const int counts[] = { 2, 4, 8, 16 };
+	 const Size size( 1920, 1080 );
+
+	 bench::Options options;
+	 options.warmup = 2;
+	 options.iterations = 20;
+	 bench::Benchmark benchmark( "blend", options );
+
+	 std::vector<Mat> frames( 16 ), masks( 16 ), bgra( 16 );
+	 for( int i = 0; i < 16; i++ )
+	 {
+		 frames[i].create( size, CV_8UC3 );
+		 randu( frames[i], Scalar::all(0), Scalar::all(256) );
+		 masks[i].create( size, CV_8UC1 );
+		 randu( masks[i], Scalar::all(0), Scalar::all(256) );
+		 bgra[i].create( size, CV_8UC4 );
+		 randu( bgra[i], Scalar::all(0), Scalar::all(256) );
+	 }
+
+	 Mat chained, blended;
+	 for( size_t k = 0; k < sizeof(counts) / sizeof(counts[0]); k++ )
+	 {
+		 const int n = counts[k];
+		 const double w = 1.0 / n;
+		 const double bytes = (double)frames[0].total() * frames[0].elemSize() * n;
+		 std::ostringstream name;
+		 name << n << " layers";
+
+		 const bench::Result a = benchmark.run( "addWeighted x" + name.str(), bytes, [&]{
+			 addWeighted( frames[0], w, frames[1], w, 0.0, chained );
+			 for( int i = 2; i < n; i++ )
+				 addWeighted( chained, 1.0, frames[i], w, 0.0, chained );
+		 } );
+
+		 std::vector<blend::Layer> layers, masked, premultiplied;
+		 for( int i = 0; i < n; i++ )
+		 {
+			 layers.push_back( blend::Layer( frames[i], w ) );
+			 masked.push_back( blend::Layer( frames[i], 1.0, i ? masks[i] : Mat() ) );
+			 premultiplied.push_back( blend::Layer( bgra[i], 1.0, Mat(), true ) );
+		 }
+		 const bench::Result b = benchmark.run( "blend " + name.str(), bytes, [&]{ blend::blend( layers, blended ); } );
+		 benchmark.run( "blend masked " + name.str(), bytes, [&]{ blend::blend( masked, blended ); } );
+		 benchmark.run( "blend premultiplied " + name.str(), bytes * 4 / 3, [&]{ blend::blend( premultiplied, blended ); } );
+
+		 blend::blend( layers, blended );
+		 cout << name.str() << ": " << std::fixed << std::setprecision(2) << a.medianMs / b.medianMs
+				  << "x faster than addWeighted, max difference " << norm( chained, blended, NORM_INF ) << endl;
+	 }
+	 cout << endl;
+	 benchmark.print( cout );
+	 return 0;
+}
+
+/**
+ * @function crossFadeStream
+ * @brief Two synthetic 1080p clips (the logos scrolling sideways, one frame
+ *        "decoded" by copying) cross-faded by transition::CrossFade, against
+ *        the same frames done one after the other with new Mats and addWeighted
+ */
+static int crossFadeStream( int frames )
+{
+	 if( frames < 1 )
+		 { cout << "Usage: --transition [frames >= 1]" << endl; return EXIT_FAILURE; }
+
+	 const Size size( 1920, 1080 );
+	 const char* names[] = { "LinuxLogo.jpg", "WindowsLogo.jpg" };
+	 Mat stills[2];
+	 for( int c = 0; c < 2; c++ )
+	 {
+		 Mat logo = imread( samples::findFile( names[c], false ) );
+		 if( logo.empty() )
+		 {
+			 // no sample data: a random picture does just as well for timing
+			 logo.create( size, CV_8UC3 );
+			 randu( logo, Scalar::all(0), Scalar::all(256) );
+		 }
+		 resize( logo, stills[c], size );
+	 }
+
+	 // frame i of clip c is its still scrolled by 8*i pixels, copied into f
+	 int next[2] = { 0, 0 };
+	 auto decode = [&]( int c, Mat& f ) {
+		 f.create( size, CV_8UC3 );
+		 const int shift = ( 8 * next[c]++ ) % size.width;
+		 Mat left = f.colRange( 0, size.width - shift ), right = f.colRange( size.width - shift, size.width );
+		 stills[c].colRange( shift, size.width ).copyTo( left );
+		 stills[c].colRange( 0, shift ).copyTo( right );
+		 return true;
+	 };
+	 Mat middle;
+	 int written = 0;
+	 auto encode = [&]( const Mat& f ) {
+		 if( written++ == frames / 2 )
+			 f.copyTo( middle );
+	 };
+
+	 /// serial: a fresh Mat per frame and stage
+	 const std::vector<int> weights = transition::schedule( frames, transition::EASE_SMOOTH );
+	 size_t serialAllocations = 0;
+	 const int64 start = getTickCount();
+	 for( int i = 0; i < frames; i++ )
+	 {
+		 Mat a, b, out;
+		 decode( 0, a );
+		 decode( 1, b );
+		 addWeighted( a, 1.0 - weights[i] / 256.0, b, weights[i] / 256.0, 0.0, out );
+		 encode( out );
+		 // counted like Stats::allocations: a buffer the Mat did not hold before
+		 serialAllocations += ( a.data != 0 ) + ( b.data != 0 ) + ( out.data != 0 );
+	 }
+	 const double serialFps = frames / ( ( getTickCount() - start ) / getTickFrequency() );
+
+	 /// streamed: decode, blend and encode overlapped, buffers from the pool
+	 next[0] = next[1] = written = 0;
+	 transition::CrossFade fade( frames, transition::EASE_SMOOTH );
+	 const transition::Stats stats = fade.run(
+		 [&]( Mat& f ){ return decode( 0, f ); },
+		 [&]( Mat& f ){ return decode( 1, f ); },
+		 encode );
+
+	 cout << std::fixed << std::setprecision(1)
+		  << "serial:   " << serialFps << " frames/s, " << serialAllocations << " frame buffers allocated" << endl
+		  << "streamed: " << stats.fps << " frames/s (" << stats.fps / serialFps << "x), " << stats.frames
+		  << " frames, " << stats.allocations << " frame buffers allocated" << endl;
+
+	 imshow( "Cross-fade, middle frame", middle );
+	 waitKey(0);
+	 return 0;
+}